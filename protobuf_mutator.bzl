@@ -0,0 +1,35 @@
+"""Rules for statically typed field accessors of protobuf messages."""
+
+def cc_proto_mutator_library(name, srcs, deps = [], **kwargs):
+    """Generates typed field accessors which Mutator uses instead of reflection.
+
+    Args:
+      name: name of the cc_library with the accessors.
+      srcs: .proto files, the same as of the cc_proto_library in deps.
+      deps: cc_proto_library of srcs.
+      **kwargs: passed to cc_library.
+    """
+    plugin = str(Label("//:protoc_plugin"))
+    library = str(Label("//:libprotobuf_mutator_lib"))
+    outs = [src[:-len(".proto")] + ".pb_mutator.cc" for src in srcs]
+    native.genrule(
+        name = name + "_gen",
+        srcs = srcs,
+        outs = outs,
+        tools = [
+            "@com_google_protobuf//:protoc",
+            plugin,
+        ],
+        cmd = ("$(location @com_google_protobuf//:protoc) " +
+               "--plugin=protoc-gen-mutator=" +
+               "$(location " + plugin + ") " +
+               "--mutator_out=$(GENDIR) -I. $(SRCS)"),
+    )
+    native.cc_library(
+        name = name,
+        srcs = outs,
+        deps = deps + [library],
+        # Accessors are registered by static initializers.
+        alwayslink = 1,
+        **kwargs
+    )
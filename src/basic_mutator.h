@@ -0,0 +1,154 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_BASIC_MUTATOR_H_
+#define SRC_BASIC_MUTATOR_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "src/field_mutator.h"
+#include "src/mutator.h"
+#include "src/random.h"
+
+namespace protobuf_mutator {
+
+// Primitive mutations of protobuf_mutator::Mutator. Policies of BasicMutator
+// can derive from it and hide some of the methods.
+struct DefaultMutationPolicy {
+  static int32_t MutateInt32(int32_t value, RandomEngine* random) {
+    return FlipBit(value, random);
+  }
+
+  static int64_t MutateInt64(int64_t value, RandomEngine* random) {
+    return FlipBit(value, random);
+  }
+
+  static uint32_t MutateUInt32(uint32_t value, RandomEngine* random) {
+    return FlipBit(value, random);
+  }
+
+  static uint64_t MutateUInt64(uint64_t value, RandomEngine* random) {
+    return FlipBit(value, random);
+  }
+
+  static float MutateFloat(float value, RandomEngine* random) {
+    return FlipBit(value, random);
+  }
+
+  static double MutateDouble(double value, RandomEngine* random) {
+    return FlipBit(value, random);
+  }
+
+  static bool MutateBool(bool value, RandomEngine* /*random*/) {
+    return !value;
+  }
+
+  static size_t MutateEnum(size_t index, size_t item_count,
+                           RandomEngine* random) {
+    if (item_count <= 1) return 0;
+    return (index + 1 + GetRandomIndex(random, item_count - 1)) % item_count;
+  }
+
+  // Deletes, inserts, duplicates or overwrites a random block of |value|.
+  // Result is built in a single pass and grows by at most
+  // |size_increase_hint| bytes, or by one byte if |value| is empty.
+  static std::string MutateString(const std::string& value,
+                                  size_t size_increase_hint,
+                                  RandomEngine* random);
+
+  // Flips random bit in the buffer.
+  static void FlipBit(size_t size, uint8_t* bytes, RandomEngine* random) {
+    size_t bit = GetRandomIndex(random, size * 8);
+    bytes[bit / 8] ^= (1u << (bit % 8));
+  }
+
+  // Flips random bit in the value.
+  template <class T>
+  static T FlipBit(T value, RandomEngine* random) {
+    FlipBit(sizeof(value), reinterpret_cast<uint8_t*>(&value), random);
+    return value;
+  }
+};
+
+// Mutator with primitive mutations resolved at compile time. Mutator calls
+// virtual Mutate* methods for every attempt to change a value. BasicMutator
+// makes a single virtual call per field and then calls static methods of
+// |Policy|, which can be inlined into the mutation loop.
+//
+// Policy has static methods with the same signatures as Mutate* methods of
+// Mutator, plus RandomEngine* as the last argument.
+//
+// Usage example:
+//    struct MyPolicy : public protobuf_mutator::DefaultMutationPolicy {
+//      static int32_t MutateInt32(int32_t value, RandomEngine* random);
+//    };
+//    protobuf_mutator::BasicMutator<MyPolicy> mutator(&random);
+template <class Policy>
+class BasicMutator : public Mutator {
+ public:
+  using Mutator::Mutator;
+
+ protected:
+  int32_t MutateInt32(int32_t value) final {
+    return Policy::MutateInt32(value, random());
+  }
+
+  int64_t MutateInt64(int64_t value) final {
+    return Policy::MutateInt64(value, random());
+  }
+
+  uint32_t MutateUInt32(uint32_t value) final {
+    return Policy::MutateUInt32(value, random());
+  }
+
+  uint64_t MutateUInt64(uint64_t value) final {
+    return Policy::MutateUInt64(value, random());
+  }
+
+  float MutateFloat(float value) final {
+    return Policy::MutateFloat(value, random());
+  }
+
+  double MutateDouble(double value) final {
+    return Policy::MutateDouble(value, random());
+  }
+
+  bool MutateBool(bool value) final {
+    return Policy::MutateBool(value, random());
+  }
+
+  size_t MutateEnum(size_t index, size_t item_count) final {
+    return Policy::MutateEnum(index, item_count, random());
+  }
+
+  std::string MutateString(const std::string& value,
+                           size_t size_increase_hint) final {
+    return Policy::MutateString(value, size_increase_hint, random());
+  }
+
+ private:
+  template <class M>
+  friend class FieldMutator;
+
+  void MutateFieldValue(const FieldInstance& field, bool create,
+                        size_t size_increase_hint) final {
+    MutateOrCreateField(field, create, size_increase_hint, this);
+  }
+};
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_BASIC_MUTATOR_H_
@@ -15,31 +15,46 @@
 
 #include "src/binary_format.h"
 
+#include <cassert>
+
+#include "google/protobuf/io/coded_stream.h"
+
 namespace protobuf_mutator {
 
 using protobuf::Message;
 
 bool ParseBinaryMessage(const uint8_t* data, size_t size, Message* output) {
-  return ParseBinaryMessage({data, data + size}, output);
+  return ParseBinaryMessage(data, size, BinaryParseLimits(), output);
 }
 
-bool ParseBinaryMessage(const std::string& data, protobuf::Message* output) {
+bool ParseBinaryMessage(const uint8_t* data, size_t size,
+                        const BinaryParseLimits& limits, Message* output) {
   output->Clear();
-  if (!output->ParsePartialFromString(data)) {
+  if (size > INT_MAX) return false;
+  protobuf::io::CodedInputStream stream(data, static_cast<int>(size));
+  stream.SetRecursionLimit(limits.recursion_limit);
+  stream.SetTotalBytesLimit(limits.total_bytes_limit);
+  if (!output->ParsePartialFromCodedStream(&stream) ||
+      !stream.ConsumedEntireMessage()) {
     output->Clear();
     return false;
   }
   return true;
 }
 
+bool ParseBinaryMessage(const std::string& data, protobuf::Message* output) {
+  return ParseBinaryMessage(reinterpret_cast<const uint8_t*>(data.data()),
+                            data.size(), output);
+}
+
 size_t SaveMessageAsBinary(const Message& message, uint8_t* data,
                            size_t max_size) {
-  std::string result = SaveMessageAsBinary(message);
-  if (result.size() <= max_size) {
-    memcpy(data, result.data(), result.size());
-    return result.size();
-  }
-  return 0;
+  size_t size = message.ByteSizeLong();
+  if (size > max_size || size > INT_MAX) return 0;
+  // Uses sizes cached by ByteSizeLong.
+  uint8_t* end = message.SerializeWithCachedSizesToArray(data);
+  assert(static_cast<size_t>(end - data) == size);
+  return end - data;
 }
 
 std::string SaveMessageAsBinary(const protobuf::Message& message) {
@@ -16,16 +16,33 @@
 #ifndef SRC_BINARY_FORMAT_H_
 #define SRC_BINARY_FORMAT_H_
 
+#include <limits.h>
+
 #include <string>
 
 #include "port/protobuf.h"
 
 namespace protobuf_mutator {
 
+// Limits of ParseBinaryMessage. Inputs which exceed them fail to parse.
+// Defaults are the defaults of protobuf::io::CodedInputStream.
+struct BinaryParseLimits {
+  // Maximal nesting depth of messages.
+  int recursion_limit = 100;
+  // Maximal size of the input.
+  int total_bytes_limit = INT_MAX;
+};
+
 // Binary serialization of protos.
+// Parses |data| in place, without a copy.
+bool ParseBinaryMessage(const uint8_t* data, size_t size,
+                        protobuf::Message* output);
 bool ParseBinaryMessage(const uint8_t* data, size_t size,
+                        const BinaryParseLimits& limits,
                         protobuf::Message* output);
 bool ParseBinaryMessage(const std::string& data, protobuf::Message* output);
+// Serializes directly into |data|. Returns 0 without serialization if the
+// message is larger than |max_size|.
 size_t SaveMessageAsBinary(const protobuf::Message& message, uint8_t* data,
                            size_t max_size);
 std::string SaveMessageAsBinary(const protobuf::Message& message);
@@ -0,0 +1,89 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/binary_format.h"
+
+#include <string>
+#include <vector>
+
+#include "port/gtest.h"
+#include "src/mutator_test_proto2.pb.h"
+
+namespace protobuf_mutator {
+
+using protobuf::util::MessageDifferencer;
+
+Msg GetNestedMessage(int depth) {
+  Msg message;
+  Msg* nested = &message;
+  for (int i = 0; i < depth; ++i) nested = nested->mutable_optional_msg();
+  nested->set_optional_string("abc");
+  return message;
+}
+
+TEST(BinaryFormatTest, SaveMessageAsBinary) {
+  Msg message = GetNestedMessage(3);
+  message.add_repeated_int32(7);
+  std::string expected = SaveMessageAsBinary(message);
+  ASSERT_FALSE(expected.empty());
+
+  std::vector<uint8_t> data(expected.size() + 1, 0xFF);
+  EXPECT_EQ(expected.size(),
+            SaveMessageAsBinary(message, data.data(), expected.size()));
+  EXPECT_EQ(expected, std::string(data.begin(), data.end() - 1));
+  // Nothing is written past the message.
+  EXPECT_EQ(0xFF, data.back());
+
+  std::vector<uint8_t> small(expected.size() - 1, 0xFF);
+  EXPECT_EQ(0u, SaveMessageAsBinary(message, small.data(), small.size()));
+  EXPECT_EQ(std::vector<uint8_t>(small.size(), 0xFF), small);
+}
+
+TEST(BinaryFormatTest, ParseBinaryMessage) {
+  Msg message = GetNestedMessage(3);
+  std::string data = SaveMessageAsBinary(message);
+  Msg parsed;
+  EXPECT_TRUE(ParseBinaryMessage(
+      reinterpret_cast<const uint8_t*>(data.data()), data.size(), &parsed));
+  EXPECT_TRUE(MessageDifferencer::Equals(message, parsed));
+  EXPECT_TRUE(ParseBinaryMessage(data, &parsed));
+  EXPECT_TRUE(MessageDifferencer::Equals(message, parsed));
+
+  // Truncated input.
+  EXPECT_FALSE(ParseBinaryMessage(data.substr(0, data.size() - 1), &parsed));
+  EXPECT_TRUE(MessageDifferencer::Equals(Msg(), parsed));
+  EXPECT_TRUE(ParseBinaryMessage(nullptr, 0, &parsed));
+}
+
+TEST(BinaryFormatTest, ParseLimits) {
+  std::string data = SaveMessageAsBinary(GetNestedMessage(10));
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  Msg parsed;
+
+  BinaryParseLimits limits;
+  EXPECT_TRUE(ParseBinaryMessage(bytes, data.size(), limits, &parsed));
+
+  limits.recursion_limit = 9;
+  EXPECT_FALSE(ParseBinaryMessage(bytes, data.size(), limits, &parsed));
+  EXPECT_TRUE(MessageDifferencer::Equals(Msg(), parsed));
+  limits.recursion_limit = 10;
+  EXPECT_TRUE(ParseBinaryMessage(bytes, data.size(), limits, &parsed));
+
+  limits.total_bytes_limit = data.size() - 1;
+  EXPECT_FALSE(ParseBinaryMessage(bytes, data.size(), limits, &parsed));
+  limits.total_bytes_limit = data.size();
+  EXPECT_TRUE(ParseBinaryMessage(bytes, data.size(), limits, &parsed));
+}
+
+}  // namespace protobuf_mutator
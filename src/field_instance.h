@@ -16,10 +16,15 @@
 #ifndef SRC_FIELD_INSTANCE_H_
 #define SRC_FIELD_INSTANCE_H_
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <utility>
 
+#include "google/protobuf/descriptor.pb.h"
 #include "port/protobuf.h"
+#include "src/generated_accessors.h"
+#include "src/message_info.h"
 
 namespace protobuf_mutator {
 
@@ -33,12 +38,31 @@ class ConstFieldInstance {
     size_t count;
   };
 
+  // Deletes message unless it's owned by an arena.
+  struct MessageDeleter {
+    void operator()(protobuf::Message* message) const {
+      if (!message->GetArena()) delete message;
+    }
+  };
+
+  // Value of message fields. Allocated on the arena of the field's message,
+  // if any.
+  using MessagePtr = std::unique_ptr<protobuf::Message, MessageDeleter>;
+
   ConstFieldInstance()
-      : message_(nullptr), descriptor_(nullptr), index_(kInvalidIndex) {}
+      : message_(nullptr),
+        reflection_(nullptr),
+        descriptor_(nullptr),
+        index_(kInvalidIndex),
+        generated_(nullptr) {}
 
   ConstFieldInstance(const protobuf::Message* message,
                      const protobuf::FieldDescriptor* field, size_t index)
-      : message_(message), descriptor_(field), index_(index) {
+      : message_(message),
+        reflection_(message->GetReflection()),
+        descriptor_(field),
+        index_(index),
+        generated_(nullptr) {
     assert(message_);
     assert(descriptor_);
     assert(index_ != kInvalidIndex);
@@ -47,12 +71,29 @@ class ConstFieldInstance {
 
   ConstFieldInstance(const protobuf::Message* message,
                      const protobuf::FieldDescriptor* field)
-      : message_(message), descriptor_(field), index_(kInvalidIndex) {
+      : message_(message),
+        reflection_(message->GetReflection()),
+        descriptor_(field),
+        index_(kInvalidIndex),
+        generated_(nullptr) {
     assert(message_);
     assert(descriptor_);
     assert(!descriptor_->is_repeated());
   }
 
+  // Same as above, but uses generated accessors of |field| if |message| is an
+  // instance of the generated class.
+  ConstFieldInstance(const protobuf::Message* message, const FieldInfo& field,
+                     size_t index)
+      : ConstFieldInstance(message, field.descriptor, index) {
+    UseGeneratedAccessors(field);
+  }
+
+  ConstFieldInstance(const protobuf::Message* message, const FieldInfo& field)
+      : ConstFieldInstance(message, field.descriptor) {
+    UseGeneratedAccessors(field);
+  }
+
   void GetDefault(int32_t* out) const {
     *out = descriptor_->default_value_int32();
   }
@@ -91,50 +132,78 @@ class ConstFieldInstance {
     *out = descriptor_->default_value_string();
   }
 
-  void GetDefault(std::unique_ptr<protobuf::Message>* out) const {
+  void GetDefault(MessagePtr* out) const {
     out->reset(reflection()
                    .GetMessageFactory()
                    ->GetPrototype(descriptor_->message_type())
-                   ->New());
+                   ->New(message_->GetArena()));
   }
 
   void Load(int32_t* value) const {
+    if (const GeneratedAccessor<int32_t>* generated = Generated<int32_t>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated()
                  ? reflection().GetRepeatedInt32(*message_, descriptor_, index_)
                  : reflection().GetInt32(*message_, descriptor_);
   }
 
   void Load(int64_t* value) const {
+    if (const GeneratedAccessor<int64_t>* generated = Generated<int64_t>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated()
                  ? reflection().GetRepeatedInt64(*message_, descriptor_, index_)
                  : reflection().GetInt64(*message_, descriptor_);
   }
 
   void Load(uint32_t* value) const {
+    if (const GeneratedAccessor<uint32_t>* generated = Generated<uint32_t>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated() ? reflection().GetRepeatedUInt32(*message_,
                                                             descriptor_, index_)
                            : reflection().GetUInt32(*message_, descriptor_);
   }
 
   void Load(uint64_t* value) const {
+    if (const GeneratedAccessor<uint64_t>* generated = Generated<uint64_t>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated() ? reflection().GetRepeatedUInt64(*message_,
                                                             descriptor_, index_)
                            : reflection().GetUInt64(*message_, descriptor_);
   }
 
   void Load(double* value) const {
+    if (const GeneratedAccessor<double>* generated = Generated<double>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated() ? reflection().GetRepeatedDouble(*message_,
                                                             descriptor_, index_)
                            : reflection().GetDouble(*message_, descriptor_);
   }
 
   void Load(float* value) const {
+    if (const GeneratedAccessor<float>* generated = Generated<float>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated()
                  ? reflection().GetRepeatedFloat(*message_, descriptor_, index_)
                  : reflection().GetFloat(*message_, descriptor_);
   }
 
   void Load(bool* value) const {
+    if (const GeneratedAccessor<bool>* generated = Generated<bool>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated()
                  ? reflection().GetRepeatedBool(*message_, descriptor_, index_)
                  : reflection().GetBool(*message_, descriptor_);
@@ -150,20 +219,38 @@ class ConstFieldInstance {
   }
 
   void Load(std::string* value) const {
+    if (const GeneratedAccessor<std::string>* generated =
+            Generated<std::string>()) {
+      *value = generated->get(*message_, static_cast<int>(index_));
+      return;
+    }
     *value = is_repeated() ? reflection().GetRepeatedString(*message_,
                                                             descriptor_, index_)
                            : reflection().GetString(*message_, descriptor_);
   }
 
-  void Load(std::unique_ptr<protobuf::Message>* value) const {
-    const protobuf::Message& source =
-        is_repeated()
-            ? reflection().GetRepeatedMessage(*message_, descriptor_, index_)
-            : reflection().GetMessage(*message_, descriptor_);
-    value->reset(source.New());
+  void Load(MessagePtr* value) const {
+    const protobuf::Message& source = GetMessage();
+    value->reset(source.New(message_->GetArena()));
     (*value)->CopyFrom(source);
   }
 
+  // Returns string value without a copy, unless the value is stored in
+  // another form. Then |scratch| is used, as by Reflection::GetStringReference.
+  const std::string& GetStringReference(std::string* scratch) const {
+    return is_repeated() ? reflection().GetRepeatedStringReference(
+                               *message_, descriptor_, index_, scratch)
+                         : reflection().GetStringReference(
+                               *message_, descriptor_, scratch);
+  }
+
+  // Returns value of the message field without a copy.
+  const protobuf::Message& GetMessage() const {
+    return is_repeated()
+               ? reflection().GetRepeatedMessage(*message_, descriptor_, index_)
+               : reflection().GetMessage(*message_, descriptor_);
+  }
+
   std::string name() const { return descriptor_->name(); }
 
   protobuf::FieldDescriptor::CppType cpp_type() const {
@@ -178,30 +265,45 @@ class ConstFieldInstance {
     return descriptor_->message_type();
   }
 
-  bool EnforceUtf8() const {
-    return descriptor_->type() == protobuf::FieldDescriptor::TYPE_STRING &&
-           descriptor()->file()->syntax() ==
-               protobuf::FileDescriptor::SYNTAX_PROTO3;
-  }
+  bool EnforceUtf8() const { return IsUtf8Field(*descriptor_); }
+
+  const protobuf::FieldDescriptor* descriptor() const { return descriptor_; }
+
+  // Returns index of the element of the repeated field, or kInvalidIndex.
+  size_t index() const { return index_; }
+
+  // Returns the message which has the field.
+  const protobuf::Message& containing_message() const { return *message_; }
 
  protected:
   bool is_repeated() const { return descriptor_->is_repeated(); }
 
-  const protobuf::Reflection& reflection() const {
-    return *message_->GetReflection();
-  }
-
-  const protobuf::FieldDescriptor* descriptor() const { return descriptor_; }
+  const protobuf::Reflection& reflection() const { return *reflection_; }
 
-  size_t index() const { return index_; }
+  // Returns generated accessor for values of type T, or nullptr if reflection
+  // must be used.
+  template <class T>
+  const GeneratedAccessor<T>* Generated() const {
+    if (!generated_) return nullptr;
+    return static_cast<const GeneratedAccessor<T>*>(generated_->accessor);
+  }
 
  private:
+  void UseGeneratedAccessors(const FieldInfo& field) {
+    assert(field.descriptor == descriptor_);
+    if (field.generated && field.generated_reflection == reflection_)
+      generated_ = field.generated;
+  }
+
   template <class Fn, class T>
   friend struct FieldFunction;
+  friend class FieldInstance;
 
   const protobuf::Message* message_;
+  const protobuf::Reflection* reflection_;
   const protobuf::FieldDescriptor* descriptor_;
   size_t index_;
+  const GeneratedFieldAccessors* generated_;
 };
 
 class FieldInstance : public ConstFieldInstance {
@@ -218,8 +320,16 @@ class FieldInstance : public ConstFieldInstance {
                 const protobuf::FieldDescriptor* field)
       : ConstFieldInstance(message, field), message_(message) {}
 
+  FieldInstance(protobuf::Message* message, const FieldInfo& field,
+                size_t index)
+      : ConstFieldInstance(message, field, index), message_(message) {}
+
+  FieldInstance(protobuf::Message* message, const FieldInfo& field)
+      : ConstFieldInstance(message, field), message_(message) {}
+
   void Delete() const {
     if (!is_repeated()) return reflection().ClearField(message_, descriptor());
+    if (ApplyToRepeatedField(EraseElement{static_cast<int>(index())})) return;
     int field_size = reflection().FieldSize(*message_, descriptor());
     // API has only method to delete the last message, so we move method from
     // the
@@ -236,6 +346,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(int32_t value) const {
+    if (const GeneratedAccessor<int32_t>* generated = Generated<int32_t>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedInt32(message_, descriptor(), index(), value);
     else
@@ -243,6 +355,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(int64_t value) const {
+    if (const GeneratedAccessor<int64_t>* generated = Generated<int64_t>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedInt64(message_, descriptor(), index(), value);
     else
@@ -250,6 +364,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(uint32_t value) const {
+    if (const GeneratedAccessor<uint32_t>* generated = Generated<uint32_t>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedUInt32(message_, descriptor(), index(), value);
     else
@@ -257,6 +373,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(uint64_t value) const {
+    if (const GeneratedAccessor<uint64_t>* generated = Generated<uint64_t>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedUInt64(message_, descriptor(), index(), value);
     else
@@ -264,6 +382,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(double value) const {
+    if (const GeneratedAccessor<double>* generated = Generated<double>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedDouble(message_, descriptor(), index(), value);
     else
@@ -271,6 +391,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(float value) const {
+    if (const GeneratedAccessor<float>* generated = Generated<float>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedFloat(message_, descriptor(), index(), value);
     else
@@ -278,6 +400,8 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(bool value) const {
+    if (const GeneratedAccessor<bool>* generated = Generated<bool>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedBool(message_, descriptor(), index(), value);
     else
@@ -295,13 +419,26 @@ class FieldInstance : public ConstFieldInstance {
   }
 
   void Store(const std::string& value) const {
+    if (const GeneratedAccessor<std::string>* generated =
+            Generated<std::string>())
+      return generated->set(message_, static_cast<int>(index()), value);
     if (is_repeated())
       reflection().SetRepeatedString(message_, descriptor(), index(), value);
     else
       reflection().SetString(message_, descriptor(), value);
   }
 
-  void Store(const std::unique_ptr<protobuf::Message>& value) const {
+  // Same as above, but moves |value| into the field.
+  void Store(std::string&& value) const {
+    if (is_repeated()) {
+      reflection().SetRepeatedString(message_, descriptor(), index(),
+                                     std::move(value));
+    } else {
+      reflection().SetString(message_, descriptor(), std::move(value));
+    }
+  }
+
+  void Store(const MessagePtr& value) const {
     protobuf::Message* mutable_message =
         is_repeated() ? reflection().MutableRepeatedMessage(
                             message_, descriptor(), index())
@@ -310,12 +447,198 @@ class FieldInstance : public ConstFieldInstance {
     if (value) mutable_message->CopyFrom(*value);
   }
 
+  // Returns mutable value of the message field, or nullptr for other types.
+  protobuf::Message* MutableMessage() const {
+    if (descriptor()->cpp_type() != protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+      return nullptr;
+    return is_repeated() ? reflection().MutableRepeatedMessage(
+                               message_, descriptor(), index())
+                         : reflection().MutableMessage(message_, descriptor());
+  }
+
+  // Returns mutable value of the repeated string field, or nullptr if the
+  // field is singular or doesn't store values as std::string. Reflection has
+  // no mutable access to singular strings.
+  std::string* MutableRepeatedString() const {
+    if (!is_repeated() ||
+        cpp_type() != protobuf::FieldDescriptor::CPPTYPE_STRING ||
+        descriptor()->options().ctype() != protobuf::FieldOptions::STRING) {
+      return nullptr;
+    }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    return reflection()
+        .MutableRepeatedPtrField<std::string>(message_, descriptor())
+        ->Mutable(static_cast<int>(index()));
+#pragma GCC diagnostic pop
+  }
+
+  // Same as Store and Create with the string or message value of |source|,
+  // but the value is copied from |source| directly, not through a temporary.
+  void StoreFrom(const ConstFieldInstance& source) const {
+    assert(source.descriptor()->cpp_type() == cpp_type());
+    if (IsOtherFieldOfOneof(source)) return StoreCopyOf(source);
+    if (cpp_type() == protobuf::FieldDescriptor::CPPTYPE_STRING) {
+      std::string scratch;
+      return Store(source.GetStringReference(&scratch));
+    }
+    const protobuf::Message& value = source.GetMessage();
+    if (!IsRecursive(value)) {
+      protobuf::Message* destination = MutableMessage();
+      if (destination != &value) destination->CopyFrom(value);
+      return;
+    }
+    // Setting the field may add a message inside |value|, copy it before.
+    MessagePtr copy = CopyOnArena(value);
+    protobuf::Message* destination = MutableMessage();
+    destination->GetReflection()->Swap(destination, copy.get());
+  }
+
+  void CreateFrom(const ConstFieldInstance& source) const {
+    if (!is_repeated()) return StoreFrom(source);
+    assert(source.descriptor()->cpp_type() == cpp_type());
+    if (cpp_type() == protobuf::FieldDescriptor::CPPTYPE_STRING) {
+      std::string scratch;
+      return InsertRepeated(source.GetStringReference(&scratch));
+    }
+    const protobuf::Message& value = source.GetMessage();
+    if (!IsRecursive(value)) {
+      reflection().AddMessage(message_, descriptor())->CopyFrom(value);
+    } else {
+      // The new element may be inside |value|, copy it before adding.
+      MessagePtr copy = CopyOnArena(value);
+      protobuf::Message* added =
+          reflection().AddMessage(message_, descriptor());
+      added->GetReflection()->Swap(added, copy.get());
+    }
+    MoveLastToIndex();
+  }
+
  private:
+  // Returns true if |source| is another field of the same oneof group of the
+  // same message. Setting the field clears the source.
+  bool IsOtherFieldOfOneof(const ConstFieldInstance& source) const {
+    return source.message_ == message_ && source.descriptor() != descriptor() &&
+           descriptor()->containing_oneof() &&
+           source.descriptor()->containing_oneof() ==
+               descriptor()->containing_oneof();
+  }
+
+  // Stores value of |source| through a temporary copy.
+  void StoreCopyOf(const ConstFieldInstance& source) const {
+    if (cpp_type() == protobuf::FieldDescriptor::CPPTYPE_STRING) {
+      std::string value;
+      source.Load(&value);
+      return Store(value);
+    }
+    MessagePtr value;
+    source.Load(&value);
+    Store(value);
+  }
+
+  // Only messages of recursive types may contain messages of the same type.
+  static bool IsRecursive(const protobuf::Message& message) {
+    return MessageInfo::Get(message.GetDescriptor()).max_nesting_depth() ==
+           MessageInfo::kUnboundedDepth;
+  }
+
+  // Returns a copy of |value| on the arena of message_. Messages on the same
+  // arena swap without a copy.
+  MessagePtr CopyOnArena(const protobuf::Message& value) const {
+    MessagePtr copy(value.New(message_->GetArena()));
+    copy->CopyFrom(value);
+    return copy;
+  }
+
+  // Removes element at |index| with a single move of the tail.
+  struct EraseElement {
+    int index;
+
+    template <class Container>
+    void operator()(Container* field) const {
+      field->erase(field->begin() + index);
+    }
+  };
+
+  // Moves the last element to |index| and the tail after it by one.
+  struct MoveLastElement {
+    int index;
+
+    template <class T>
+    void operator()(protobuf::RepeatedField<T>* field) const {
+      std::rotate(field->begin() + index, field->end() - 1, field->end());
+    }
+
+    template <class T>
+    void operator()(protobuf::RepeatedPtrField<T>* field) const {
+      std::rotate(field->pointer_begin() + index, field->pointer_end() - 1,
+                  field->pointer_end());
+    }
+  };
+
+  // Calls |op| with the container of the repeated field. Reflection has no
+  // insert or erase in the middle, and SwapElements costs a reflection call
+  // per element. Returns false if the field has no such container.
+  template <class Op>
+  bool ApplyToRepeatedField(const Op& op) const {
+    assert(is_repeated());
+    // Get(Mutable)RepeatedFieldRef does not expose the containers.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    switch (cpp_type()) {
+      case protobuf::FieldDescriptor::CPPTYPE_INT32:
+        op(reflection().MutableRepeatedField<int32_t>(message_, descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_INT64:
+        op(reflection().MutableRepeatedField<int64_t>(message_, descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_UINT32:
+        op(reflection().MutableRepeatedField<uint32_t>(message_,
+                                                        descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_UINT64:
+        op(reflection().MutableRepeatedField<uint64_t>(message_,
+                                                        descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+        op(reflection().MutableRepeatedField<double>(message_, descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+        op(reflection().MutableRepeatedField<float>(message_, descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_BOOL:
+        op(reflection().MutableRepeatedField<bool>(message_, descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_ENUM:
+        op(reflection().MutableRepeatedField<int>(message_, descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_STRING:
+        if (descriptor()->options().ctype() != protobuf::FieldOptions::STRING)
+          return false;
+        op(reflection().MutableRepeatedPtrField<std::string>(message_,
+                                                              descriptor()));
+        return true;
+      case protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+        op(reflection().MutableRepeatedPtrField<protobuf::Message>(
+            message_, descriptor()));
+        return true;
+    }
+#pragma GCC diagnostic pop
+    return false;
+  }
+
   template <class T>
   void InsertRepeated(const T& value) const {
     PushBackRepeated(value);
+    MoveLastToIndex();
+  }
+
+  // Moves the element just added to the end of the repeated field to index().
+  void MoveLastToIndex() const {
     size_t field_size = reflection().FieldSize(*message_, descriptor());
     if (field_size == 1) return;
+    if (ApplyToRepeatedField(MoveLastElement{static_cast<int>(index())}))
+      return;
     // API has only method to add field to the end of the list. So we add
     // descriptor()
     // and move it into the middle.
@@ -371,7 +694,7 @@ class FieldInstance : public ConstFieldInstance {
     reflection().AddString(message_, descriptor(), value);
   }
 
-  void PushBackRepeated(const std::unique_ptr<protobuf::Message>& value) const {
+  void PushBackRepeated(const MessagePtr& value) const {
     assert(is_repeated());
     protobuf::Message* mutable_message =
         reflection().AddMessage(message_, descriptor());
@@ -418,8 +741,7 @@ struct FieldFunction {
             field, args...);
       case FieldDescriptor::CPPTYPE_MESSAGE:
         return static_cast<const Fn*>(this)
-            ->template ForType<std::unique_ptr<protobuf::Message>>(field,
-                                                                   args...);
+            ->template ForType<ConstFieldInstance::MessagePtr>(field, args...);
     }
     assert(false && "Unknown type");
     abort();
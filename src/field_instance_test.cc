@@ -0,0 +1,148 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/field_instance.h"
+
+#include <memory>
+#include <string>
+
+#include "google/protobuf/dynamic_message.h"
+#include "port/gtest.h"
+#include "src/mutator_test_proto2.pb.h"
+
+namespace protobuf_mutator {
+
+using protobuf::FieldDescriptor;
+using protobuf::Message;
+
+class FieldInstanceTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    const char kMessage[] = R"(
+        repeated_int32: [0, 1, 2]
+        repeated_string: ["0", "1", "2"]
+        repeated_enum: [ENUM_0, ENUM_1, ENUM_2]
+        repeated_msg { optional_int32: 0 }
+        repeated_msg { optional_int32: 1 }
+        repeated_msg { optional_int32: 2 })";
+    if (GetParam()) {
+      message_.reset(factory_.GetPrototype(Msg::descriptor())->New());
+    } else {
+      message_.reset(new Msg);
+    }
+    protobuf::TextFormat::Parser parser;
+    parser.AllowPartialMessage(true);
+    ASSERT_TRUE(parser.ParseFromString(kMessage, message_.get()));
+  }
+
+  const FieldDescriptor* Field(const std::string& name) const {
+    return Msg::descriptor()->FindFieldByName(name);
+  }
+
+  // Returns message as Msg, to compare with expected text.
+  Msg AsMsg() const {
+    Msg message;
+    message.CopyFrom(*message_);
+    return message;
+  }
+
+  std::string Text() const { return AsMsg().ShortDebugString(); }
+
+  protobuf::DynamicMessageFactory factory_;
+  std::unique_ptr<Message> message_;
+};
+
+INSTANTIATE_TEST_CASE_P(Generated, FieldInstanceTest, ::testing::Values(false));
+INSTANTIATE_TEST_CASE_P(Dynamic, FieldInstanceTest, ::testing::Values(true));
+
+TEST_P(FieldInstanceTest, Delete) {
+  FieldInstance(message_.get(), Field("repeated_int32"), 1).Delete();
+  FieldInstance(message_.get(), Field("repeated_string"), 0).Delete();
+  FieldInstance(message_.get(), Field("repeated_enum"), 2).Delete();
+  FieldInstance(message_.get(), Field("repeated_msg"), 1).Delete();
+  EXPECT_EQ(
+      "repeated_int32: 0 repeated_int32: 2 "
+      "repeated_string: \"1\" repeated_string: \"2\" "
+      "repeated_enum: ENUM_0 repeated_enum: ENUM_1 "
+      "repeated_msg { optional_int32: 0 } repeated_msg { optional_int32: 2 }",
+      Text());
+}
+
+TEST_P(FieldInstanceTest, Create) {
+  FieldInstance(message_.get(), Field("repeated_int32"), 1).Create(int32_t(7));
+  FieldInstance(message_.get(), Field("repeated_string"), 0)
+      .Create(std::string("7"));
+  FieldInstance(message_.get(), Field("repeated_enum"), 3)
+      .Create(ConstFieldInstance::Enum{7, 10});
+  Msg value;
+  value.set_optional_int32(7);
+  FieldInstance(message_.get(), Field("repeated_msg"), 2)
+      .Create(ConstFieldInstance::MessagePtr(new Msg(value)));
+  EXPECT_EQ(
+      "repeated_int32: 0 repeated_int32: 7 repeated_int32: 1 "
+      "repeated_int32: 2 "
+      "repeated_string: \"7\" repeated_string: \"0\" repeated_string: \"1\" "
+      "repeated_string: \"2\" "
+      "repeated_enum: ENUM_0 repeated_enum: ENUM_1 repeated_enum: ENUM_2 "
+      "repeated_enum: ENUM_7 "
+      "repeated_msg { optional_int32: 0 } repeated_msg { optional_int32: 1 } "
+      "repeated_msg { optional_int32: 7 } repeated_msg { optional_int32: 2 }",
+      Text());
+}
+
+TEST_P(FieldInstanceTest, StoreFrom) {
+  Message* nested = FieldInstance(message_.get(), Field("optional_msg"))
+                        .MutableMessage();
+  FieldInstance(nested, Field("optional_string"))
+      .StoreFrom(ConstFieldInstance(message_.get(), Field("repeated_string"),
+                                    2));
+  // Source contains the destination.
+  FieldInstance(nested, Field("optional_msg"))
+      .StoreFrom(ConstFieldInstance(message_.get(), Field("optional_msg")));
+  EXPECT_EQ("optional_string: \"2\" optional_msg { optional_string: \"2\" }",
+            AsMsg().optional_msg().ShortDebugString());
+
+  // Destination contains the source.
+  FieldInstance(message_.get(), Field("optional_msg"))
+      .StoreFrom(ConstFieldInstance(nested, Field("optional_msg")));
+  EXPECT_EQ("optional_string: \"2\"",
+            AsMsg().optional_msg().ShortDebugString());
+}
+
+TEST_P(FieldInstanceTest, CreateFrom) {
+  FieldInstance(message_.get(), Field("repeated_string"), 1)
+      .CreateFrom(ConstFieldInstance(message_.get(), Field("repeated_string"),
+                                     2));
+  // Source contains the destination.
+  Message* nested = FieldInstance(message_.get(), Field("repeated_msg"), 0)
+                        .MutableMessage();
+  FieldInstance(nested, Field("repeated_msg"), 0)
+      .CreateFrom(
+          ConstFieldInstance(message_.get(), Field("repeated_msg"), 0));
+  FieldInstance(nested, Field("repeated_msg"), 0)
+      .CreateFrom(
+          ConstFieldInstance(message_.get(), Field("repeated_msg"), 1));
+  EXPECT_EQ(
+      "repeated_int32: 0 repeated_int32: 1 repeated_int32: 2 "
+      "repeated_string: \"0\" repeated_string: \"2\" "
+      "repeated_string: \"1\" repeated_string: \"2\" "
+      "repeated_enum: ENUM_0 repeated_enum: ENUM_1 repeated_enum: ENUM_2 "
+      "repeated_msg { optional_int32: 0 "
+      "repeated_msg { optional_int32: 1 } repeated_msg { optional_int32: 0 } "
+      "} "
+      "repeated_msg { optional_int32: 1 } repeated_msg { optional_int32: 2 }",
+      Text());
+}
+
+}  // namespace protobuf_mutator
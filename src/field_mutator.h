@@ -0,0 +1,260 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_FIELD_MUTATOR_H_
+#define SRC_FIELD_MUTATOR_H_
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "src/field_instance.h"
+#include "src/random.h"
+#include "src/utf8_fix.h"
+
+namespace protobuf_mutator {
+
+// Inserts a random block of |source| into |value|, or overwrites a block of
+// |value| with it. Result grows by at most |size_increase_hint| bytes.
+std::string SpliceString(const std::string& value, const std::string& source,
+                         size_t size_increase_hint, RandomEngine* random);
+
+// Mutates values of fields with primitive mutations of |M|, which is Mutator or
+// a class derived from it. Calls are resolved statically if |M| declares the
+// primitive mutations final, e.g. BasicMutator.
+template <class M>
+class FieldMutator {
+ public:
+  FieldMutator(size_t size_increase_hint, bool enforce_changes,
+               bool enforce_utf8_strings, M* mutator)
+      : size_increase_hint_(size_increase_hint),
+        enforce_changes_(enforce_changes),
+        enforce_utf8_strings_(enforce_utf8_strings),
+        mutator_(mutator) {}
+
+  // Value of another string field. Mutations of strings sometimes splice a
+  // block of it into the mutated value.
+  void set_splice_source(const std::string* source) { splice_source_ = source; }
+
+  void Mutate(int32_t* value) const {
+    RepeatMutate(value, [this](int32_t v) { return mutator_->MutateInt32(v); });
+  }
+
+  void Mutate(int64_t* value) const {
+    RepeatMutate(value, [this](int64_t v) { return mutator_->MutateInt64(v); });
+  }
+
+  void Mutate(uint32_t* value) const {
+    RepeatMutate(value,
+                 [this](uint32_t v) { return mutator_->MutateUInt32(v); });
+  }
+
+  void Mutate(uint64_t* value) const {
+    RepeatMutate(value,
+                 [this](uint64_t v) { return mutator_->MutateUInt64(v); });
+  }
+
+  void Mutate(float* value) const {
+    RepeatMutate(value, [this](float v) { return mutator_->MutateFloat(v); });
+  }
+
+  void Mutate(double* value) const {
+    RepeatMutate(value, [this](double v) { return mutator_->MutateDouble(v); });
+  }
+
+  void Mutate(bool* value) const {
+    RepeatMutate(value, [this](bool v) { return mutator_->MutateBool(v); }, 2);
+  }
+
+  void Mutate(FieldInstance::Enum* value) const {
+    size_t count = value->count;
+    RepeatMutate(
+        &value->index,
+        [this, count](size_t v) { return mutator_->MutateEnum(v, count); },
+        std::max<size_t>(count, 1));
+    assert(value->index < value->count);
+  }
+
+  void Mutate(std::string* value) const {
+    if (value->size() > mutator_->string_window_size_)
+      return MutateWindow(value);
+    RepeatMutate(value, [this](const std::string& v) {
+      std::string result = MutateString(v, size_increase_hint_);
+      if (enforce_utf8_strings_) FixUtf8String(&result, mutator_->random());
+      return result;
+    });
+  }
+
+  void Mutate(ConstFieldInstance::MessagePtr* message) const {
+    assert(!enforce_changes_);
+    assert(*message);
+    if (GetRandomBool(mutator_->random(), 100)) return;
+    mutator_->Mutate(message->get(), size_increase_hint_);
+  }
+
+ private:
+  template <class T, class F>
+  void RepeatMutate(T* value, F mutate,
+                    size_t unchanged_one_out_of = 100) const {
+    if (!enforce_changes_ &&
+        GetRandomBool(mutator_->random(), unchanged_one_out_of)) {
+      return;
+    }
+    T tmp = *value;
+    for (int i = 0; i < 10; ++i) {
+      *value = mutate(*value);
+      if (!enforce_changes_ || *value != tmp) return;
+    }
+  }
+
+  // Mutates a random window of a string too large to copy for every attempt.
+  // The window is copied into the scratch buffer of the mutator and the result
+  // replaces it in |value|, the rest of the value is untouched, except for
+  // UTF-8 code points which cross boundaries of the window.
+  void MutateWindow(std::string* value) const {
+    if (!enforce_changes_ && GetRandomBool(mutator_->random(), 100)) return;
+    size_t window = mutator_->string_window_size_;
+    size_t begin =
+        GetRandomIndex(mutator_->random(), value->size() - window + 1);
+    std::string& original = mutator_->string_scratch_;
+    original.assign(*value, begin, window);
+    size_t size_increase_hint = std::min(size_increase_hint_, window);
+    size_t size = window;
+    for (int i = 0; i < 10; ++i) {
+      std::string result = MutateString(original, size_increase_hint);
+      value->replace(begin, size, result);
+      size = result.size();
+      if (enforce_utf8_strings_)
+        FixUtf8String(value, begin, begin + size, mutator_->random());
+      if (!enforce_changes_ || value->compare(begin, size, original)) break;
+    }
+  }
+
+  std::string MutateString(const std::string& value,
+                           size_t size_increase_hint) const {
+    // Splice is as likely as each block mutation of DefaultMutationPolicy.
+    return splice_source_ && GetRandomBool(mutator_->random(), 5)
+               ? SpliceString(value, *splice_source_, size_increase_hint,
+                              mutator_->random())
+               : mutator_->MutateString(value, size_increase_hint);
+  }
+
+  size_t size_increase_hint_;
+  size_t enforce_changes_;
+  bool enforce_utf8_strings_;
+  const std::string* splice_source_ = nullptr;
+  M* mutator_;
+};
+
+template <class M>
+struct MutateField : public FieldFunction<MutateField<M>> {
+  template <class T>
+  void ForType(const FieldInstance& field, size_t size_increase_hint,
+               M* mutator) const {
+    FieldMutator<M> field_mutator(size_increase_hint, true,
+                                  field.EnforceUtf8(), mutator);
+    Mutate(field, &field_mutator, mutator->random(), static_cast<T*>(nullptr));
+  }
+
+ private:
+  // Strings are mutated in place if possible, or moved back into the field.
+  void Mutate(const FieldInstance& field, FieldMutator<M>* field_mutator,
+              RandomEngine* random, std::string*) const {
+    std::string scratch;
+    field_mutator->set_splice_source(
+        SelectSpliceSource(field, &scratch, random));
+    if (std::string* value = field.MutableRepeatedString())
+      return field_mutator->Mutate(value);
+    std::string value;
+    field.Load(&value);
+    field_mutator->Mutate(&value);
+    field.Store(std::move(value));
+  }
+
+  template <class T>
+  void Mutate(const FieldInstance& field, FieldMutator<M>* field_mutator,
+              RandomEngine* /*random*/, T*) const {
+    T value;
+    field.Load(&value);
+    field_mutator->Mutate(&value);
+    field.Store(value);
+  }
+
+  // Returns a random non-empty value of another string field of the message
+  // of |field|, or nullptr. |scratch| is used as by GetStringReference.
+  static const std::string* SelectSpliceSource(const FieldInstance& field,
+                                               std::string* scratch,
+                                               RandomEngine* random) {
+    const protobuf::Message& message = field.containing_message();
+    const protobuf::Reflection* reflection = message.GetReflection();
+    const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+    const FieldInfo* selected = nullptr;
+    int selected_index = 0;
+    size_t count = 0;
+    for (int i : info.string_fields()) {
+      const FieldInfo& other = info.fields()[i];
+      if (other.descriptor == field.descriptor()) continue;
+      size_t size = 1;
+      if (other.is_repeated)
+        size = reflection->FieldSize(message, other.descriptor);
+      else if (!reflection->HasField(message, other.descriptor))
+        continue;
+      if (!size) continue;
+      // Reservoir sampling of elements.
+      count += size;
+      if (GetRandomIndex(random, count) >= size) continue;
+      selected = &other;
+      selected_index = GetRandomIndex(random, size);
+    }
+    if (!selected) return nullptr;
+    const std::string& value =
+        selected->is_repeated
+            ? ConstFieldInstance(&message, *selected, selected_index)
+                  .GetStringReference(scratch)
+            : ConstFieldInstance(&message, *selected)
+                  .GetStringReference(scratch);
+    return value.empty() ? nullptr : &value;
+  }
+};
+
+template <class M>
+struct CreateField : public FieldFunction<CreateField<M>> {
+ public:
+  template <class T>
+  void ForType(const FieldInstance& field, size_t size_increase_hint,
+               M* mutator) const {
+    T value;
+    field.GetDefault(&value);
+    FieldMutator<M> field_mutator(size_increase_hint,
+                                  false /* defaults could be useful */,
+                                  field.EnforceUtf8(), mutator);
+    field_mutator.Mutate(&value);
+    field.Create(value);
+  }
+};
+
+// Mutates value of |field|, or creates the field with a random value if
+// |create| is set.
+template <class M>
+void MutateOrCreateField(const FieldInstance& field, bool create,
+                         size_t size_increase_hint, M* mutator) {
+  if (create)
+    CreateField<M>()(field, size_increase_hint, mutator);
+  else
+    MutateField<M>()(field, size_increase_hint, mutator);
+}
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_FIELD_MUTATOR_H_
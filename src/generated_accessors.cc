@@ -0,0 +1,54 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/generated_accessors.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace protobuf_mutator {
+
+namespace {
+
+using AccessorsMap =
+    std::unordered_map<std::string, const GeneratedMessageAccessors*>;
+
+// Function statics, registrations run from static initializers of other
+// translation units.
+std::mutex& GetAccessorsMutex() {
+  static std::mutex* mutex = new std::mutex;
+  return *mutex;
+}
+
+AccessorsMap& GetAccessorsMap() {
+  static AccessorsMap* map = new AccessorsMap;
+  return *map;
+}
+
+}  // namespace
+
+GeneratedAccessorsRegistration::GeneratedAccessorsRegistration(
+    const GeneratedMessageAccessors* accessors) {
+  std::lock_guard<std::mutex> lock(GetAccessorsMutex());
+  GetAccessorsMap()[accessors->full_name] = accessors;
+}
+
+const GeneratedMessageAccessors* FindGeneratedAccessors(
+    const std::string& full_name) {
+  std::lock_guard<std::mutex> lock(GetAccessorsMutex());
+  auto it = GetAccessorsMap().find(full_name);
+  return it == GetAccessorsMap().end() ? nullptr : it->second;
+}
+
+}  // namespace protobuf_mutator
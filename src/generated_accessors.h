@@ -0,0 +1,67 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_GENERATED_ACCESSORS_H_
+#define SRC_GENERATED_ACCESSORS_H_
+
+#include <string>
+
+#include "port/protobuf.h"
+
+namespace protobuf_mutator {
+
+// Statically typed getter and setter of a scalar or string field of generated
+// message class. |message| must be an instance of that class. |index| is the
+// element of repeated fields and is ignored for singular fields.
+template <class T>
+struct GeneratedAccessor {
+  T (*get)(const protobuf::Message& message, int index);
+  void (*set)(protobuf::Message* message, int index, const T& value);
+};
+
+// Accessor of a single field. |accessor| points to GeneratedAccessor<T>, where
+// T is the type ConstFieldInstance uses for |cpp_type|.
+struct GeneratedFieldAccessors {
+  int number;
+  protobuf::FieldDescriptor::CppType cpp_type;
+  const void* accessor;
+};
+
+// Accessors of fields of generated message class. Fields without accessors,
+// e.g. enums and messages, are handled with reflection.
+struct GeneratedMessageAccessors {
+  // Full name of the message type.
+  const char* full_name;
+  // Returns reflection of the generated class. Messages with other reflection,
+  // e.g. DynamicMessage of the same type, don't use the accessors.
+  const protobuf::Reflection* (*reflection)();
+  const GeneratedFieldAccessors* fields;
+  int field_count;
+};
+
+// Registers accessors from static initializer. Code generated by
+// src/protoc_plugin defines one instance for each message.
+class GeneratedAccessorsRegistration {
+ public:
+  explicit GeneratedAccessorsRegistration(
+      const GeneratedMessageAccessors* accessors);
+};
+
+// Returns accessors registered for |full_name| or nullptr.
+const GeneratedMessageAccessors* FindGeneratedAccessors(
+    const std::string& full_name);
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_GENERATED_ACCESSORS_H_
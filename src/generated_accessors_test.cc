@@ -0,0 +1,109 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/generated_accessors.h"
+
+#include <memory>
+
+#include "google/protobuf/dynamic_message.h"
+#include "port/gtest.h"
+#include "src/field_instance.h"
+#include "src/message_info.h"
+#include "src/mutator.h"
+#include "src/mutator_test_proto2.pb.h"
+
+namespace protobuf_mutator {
+namespace {
+
+// Same as what src/protoc_plugin generates for Msg.SubMsg, with call counters.
+int get_calls = 0;
+int set_calls = 0;
+
+const GeneratedAccessor<int64_t> kOptionalInt64 = {
+    [](const protobuf::Message& message, int) -> int64_t {
+      ++get_calls;
+      return static_cast<const Msg_SubMsg&>(message).optional_int64();
+    },
+    [](protobuf::Message* message, int, const int64_t& value) {
+      ++set_calls;
+      static_cast<Msg_SubMsg*>(message)->set_optional_int64(value);
+    }};
+
+const GeneratedFieldAccessors kFields[] = {
+    {1, protobuf::FieldDescriptor::CPPTYPE_INT64, &kOptionalInt64},
+};
+
+const GeneratedMessageAccessors kMessage = {
+    "protobuf_mutator.Msg.SubMsg", &Msg_SubMsg::GetReflection, kFields, 1};
+const GeneratedAccessorsRegistration kRegistration(&kMessage);
+
+class GeneratedAccessorsTest : public ::testing::Test {
+ protected:
+  void SetUp() override { get_calls = set_calls = 0; }
+};
+
+TEST_F(GeneratedAccessorsTest, Registration) {
+  EXPECT_EQ(&kMessage, FindGeneratedAccessors("protobuf_mutator.Msg.SubMsg"));
+  EXPECT_EQ(nullptr, FindGeneratedAccessors("protobuf_mutator.Msg"));
+
+  const MessageInfo& info = MessageInfo::Get(Msg::SubMsg::descriptor());
+  ASSERT_EQ(1u, info.fields().size());
+  EXPECT_EQ(&kFields[0], info.fields()[0].generated);
+  EXPECT_EQ(Msg::SubMsg::GetReflection(),
+            info.fields()[0].generated_reflection);
+
+  for (const FieldInfo& field : MessageInfo::Get(Msg::descriptor()).fields())
+    EXPECT_EQ(nullptr, field.generated);
+}
+
+TEST_F(GeneratedAccessorsTest, LoadAndStore) {
+  Msg::SubMsg message;
+  const FieldInfo& info =
+      MessageInfo::Get(Msg::SubMsg::descriptor()).fields()[0];
+  FieldInstance field(&message, info);
+  field.Store(int64_t(42));
+  EXPECT_EQ(42, message.optional_int64());
+  int64_t value = 0;
+  field.Load(&value);
+  EXPECT_EQ(42, value);
+  EXPECT_EQ(1, get_calls);
+  EXPECT_EQ(1, set_calls);
+}
+
+TEST_F(GeneratedAccessorsTest, DynamicMessage) {
+  protobuf::DynamicMessageFactory factory;
+  std::unique_ptr<protobuf::Message> message(
+      factory.GetPrototype(Msg::SubMsg::descriptor())->New());
+  const FieldInfo& info =
+      MessageInfo::Get(Msg::SubMsg::descriptor()).fields()[0];
+  FieldInstance field(message.get(), info);
+  field.Store(int64_t(42));
+  int64_t value = 0;
+  field.Load(&value);
+  EXPECT_EQ(42, value);
+  // Reflection of DynamicMessage differs from the generated one.
+  EXPECT_EQ(0, get_calls);
+  EXPECT_EQ(0, set_calls);
+}
+
+TEST_F(GeneratedAccessorsTest, Mutate) {
+  RandomEngine random(1);
+  Mutator mutator(&random);
+  Msg::SubMsg message;
+  for (int i = 0; i < 100; ++i) mutator.Mutate(&message, 100);
+  EXPECT_GT(set_calls, 0);
+}
+
+}  // namespace
+}  // namespace protobuf_mutator
@@ -15,28 +15,132 @@
 
 #include "src/libfuzzer/libfuzzer_macro.h"
 
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "src/binary_format.h"
 #include "src/libfuzzer/libfuzzer_mutator.h"
+#include "src/message_fingerprint.h"
+#include "src/message_info.h"
+#include "src/mutation_index.h"
+#include "src/mutation_scheduler.h"
 #include "src/text_format.h"
+#include "src/wire_mutator.h"
 
 namespace protobuf_mutator {
 namespace libfuzzer {
 
 namespace {
 
+std::atomic<size_t> mutation_stack_depth(1);
+std::atomic<bool> allow_malformed_wire_mutations(false);
+std::atomic<bool> adaptive_mutation_scheduling(false);
+std::atomic<int> binary_recursion_limit(BinaryParseLimits().recursion_limit);
+std::atomic<int> binary_total_bytes_limit(
+    BinaryParseLimits().total_bytes_limit);
+// Incremented when parsing results change, invalidates ParsedInputCache.
+std::atomic<uint32_t> parse_generation(0);
+
+BinaryParseLimits GetBinaryParseLimits() {
+  BinaryParseLimits limits;
+  limits.recursion_limit = binary_recursion_limit;
+  limits.total_bytes_limit = binary_total_bytes_limit;
+  return limits;
+}
+
+// Returns true if nested messages of |message| are at most |max_depth| levels
+// deep, as counted by the recursion limit of CodedInputStream.
+bool FitsRecursionLimit(const protobuf::Message& message, int max_depth) {
+  if (max_depth < 0) return false;
+  const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+  if (info.max_nesting_depth() <= max_depth) return true;
+  const protobuf::Reflection* reflection = message.GetReflection();
+  for (int i : info.message_fields()) {
+    const FieldInfo& field = info.fields()[i];
+    if (field.is_repeated) {
+      int field_size = reflection->FieldSize(message, field.descriptor);
+      for (int j = 0; j < field_size; ++j) {
+        if (!FitsRecursionLimit(
+                reflection->GetRepeatedMessage(message, field.descriptor, j),
+                max_depth - 1)) {
+          return false;
+        }
+      }
+    } else if (reflection->HasField(message, field.descriptor)) {
+      if (!FitsRecursionLimit(
+              reflection->GetMessage(message, field.descriptor),
+              max_depth - 1)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Returns true if parsing of the output |message| of |size| bytes is known to
+// give the message back. Text format prints every NaN as nan, parsing of maps
+// drops duplicate keys, and Mutator nests messages deeper than the default
+// recursion limit.
+bool OutputParsesBack(bool binary, const protobuf::Message& message,
+                      size_t size) {
+  if (!binary || MessageInfo::Get(message.GetDescriptor()).has_map_fields())
+    return false;
+  BinaryParseLimits limits = GetBinaryParseLimits();
+  return size <= static_cast<size_t>(limits.total_bytes_limit) &&
+         FitsRecursionLimit(message, limits.recursion_limit);
+}
+
+// Size of the arena block which is kept between fuzzer calls.
+const size_t kArenaInitialBlockSize = 1 << 16;
+
+struct ThreadArena {
+  ThreadArena() : block(new char[kArenaInitialBlockSize]) {
+    protobuf::ArenaOptions options;
+    options.initial_block = block.get();
+    options.initial_block_size = kArenaInitialBlockSize;
+    arena.reset(new protobuf::Arena(options));
+  }
+
+  // Declared before arena to outlive it.
+  std::unique_ptr<char[]> block;
+  std::unique_ptr<protobuf::Arena> arena;
+  int scopes = 0;
+};
+
+ThreadArena& GetThreadArena() {
+  thread_local ThreadArena thread_arena;
+  return thread_arena;
+}
+
+// Returns scheduler of the current thread, or nullptr if adaptive scheduling
+// is disabled.
+MutationScheduler* GetThreadScheduler() {
+  if (!adaptive_mutation_scheduling) return nullptr;
+  thread_local MutationScheduler scheduler;
+  return &scheduler;
+}
+
 class InputReader {
  public:
-  InputReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+  InputReader(const uint8_t* data, size_t size, bool binary)
+      : data_(data), size_(size), binary_(binary) {}
   virtual ~InputReader() = default;
 
   virtual bool Read(protobuf::Message* message) const = 0;
 
   const uint8_t* data() const { return data_; }
   size_t size() const { return size_; }
+  bool binary() const { return binary_; }
 
  private:
   const uint8_t* data_;
   size_t size_;
+  bool binary_;
 };
 
 class OutputWriter {
@@ -49,6 +153,9 @@ class OutputWriter {
   uint8_t* data() const { return data_; }
   size_t size() const { return size_; }
 
+  // Redirects output into another buffer of the same size.
+  void set_data(uint8_t* data) { data_ = data; }
+
  private:
   uint8_t* data_;
   size_t size_;
@@ -56,7 +163,8 @@ class OutputWriter {
 
 class TextInputReader : public InputReader {
  public:
-  using InputReader::InputReader;
+  TextInputReader(const uint8_t* data, size_t size)
+      : InputReader(data, size, false) {}
 
   bool Read(protobuf::Message* message) const override {
     return ParseTextMessage(data(), size(), message);
@@ -65,19 +173,32 @@ class TextInputReader : public InputReader {
 
 class TextOutputWriter : public OutputWriter {
  public:
-  using OutputWriter::OutputWriter;
+  // |overwrites_input| is true if |data| holds the input. libFuzzer mutates
+  // the same data again if the output doesn't fit, so the data must be kept.
+  TextOutputWriter(uint8_t* data, size_t size, bool overwrites_input)
+      : OutputWriter(data, size), overwrites_input_(overwrites_input) {}
 
   size_t Write(const protobuf::Message& message) override {
-    return SaveMessageAsText(message, data(), size());
+    if (!overwrites_input_) return SaveMessageAsText(message, data(), size());
+    // Printing stops at the end of the buffer, so it's never reallocated.
+    thread_local std::vector<uint8_t> buffer;
+    if (buffer.size() < size()) buffer.resize(size());
+    size_t new_size = SaveMessageAsText(message, buffer.data(), size());
+    memcpy(data(), buffer.data(), new_size);
+    return new_size;
   }
+
+ private:
+  bool overwrites_input_;
 };
 
 class BinaryInputReader : public InputReader {
  public:
-  using InputReader::InputReader;
+  BinaryInputReader(const uint8_t* data, size_t size)
+      : InputReader(data, size, true) {}
 
   bool Read(protobuf::Message* message) const override {
-    return ParseBinaryMessage(data(), size(), message);
+    return ParseBinaryMessage(data(), size(), GetBinaryParseLimits(), message);
   }
 };
 
@@ -90,30 +211,249 @@ class BinaryOutputWriter : public OutputWriter {
   }
 };
 
+// Messages parsed from recent inputs of the thread. libFuzzer passes the same
+// corpus entries to mutation and crossover again and again, and with
+// -mutate_depth it passes the output of the previous mutation back as the
+// next input.
+class ParsedInputCache {
+ public:
+  // Sets |message| to the parsed input. Returns the result of input.Read().
+  bool Read(const InputReader& input, protobuf::Message* message) {
+    uint64_t hash = FingerprintBytes(input.data(), input.size());
+    if (const Entry* entry = Find(input, *message, hash)) {
+      message->CopyFrom(*entry->message);
+      return entry->parsed;
+    }
+    bool parsed = input.Read(message);
+    Entry& entry = entries_[next_entry_];
+    next_entry_ = (next_entry_ + 1) % kEntryCount;
+    Reset(input.binary(), input.data(), input.size(), hash, *message, &entry);
+    entry.parsed = parsed;
+    entry.message->CopyFrom(*message);
+    return parsed;
+  }
+
+  // Returns the message written by the last SetLastOutput() if |input| is its
+  // output, or nullptr. Moves the index of the message, if any, into |index|.
+  // The caller may mutate the message, but must call SetLastOutput() or
+  // ClearLastOutput() then.
+  protobuf::Message* FindLastOutput(const InputReader& input,
+                                    const protobuf::Message& prototype,
+                                    std::unique_ptr<MutationIndex>* index) {
+    uint64_t hash = FingerprintBytes(input.data(), input.size());
+    if (!Matches(last_output_, input, prototype, hash)) return nullptr;
+    *index = std::move(last_output_.index);
+    return last_output_.message.get();
+  }
+
+  // Remembers |message| as parsed |data|. Takes the content of |message|,
+  // unless it's the one returned by FindLastOutput(). |index| is the index of
+  // |message| or nullptr.
+  void SetLastOutput(bool binary, const uint8_t* data, size_t size,
+                     protobuf::Message* message,
+                     std::unique_ptr<MutationIndex> index) {
+    uint64_t hash = FingerprintBytes(data, size);
+    if (message != last_output_.message.get()) {
+      Reset(binary, data, size, hash, *message, &last_output_);
+      last_output_.message->GetReflection()->Swap(last_output_.message.get(),
+                                                  message);
+    } else {
+      last_output_.binary = binary;
+      last_output_.hash = hash;
+      last_output_.data.assign(data, data + size);
+    }
+    last_output_.parsed = true;
+    last_output_.index = std::move(index);
+  }
+
+  void ClearLastOutput() {
+    last_output_.descriptor = nullptr;
+    last_output_.index.reset();
+  }
+
+ private:
+  static const size_t kEntryCount = 16;
+
+  struct Entry {
+    const protobuf::Descriptor* descriptor = nullptr;
+    uint32_t generation = 0;
+    bool binary = false;
+    uint64_t hash = 0;
+    std::string data;
+    std::unique_ptr<protobuf::Message> message;
+    bool parsed = false;
+    // Index of the last output, updated by its mutations.
+    std::unique_ptr<MutationIndex> index;
+  };
+
+  static bool Matches(const Entry& entry, const InputReader& input,
+                      const protobuf::Message& message, uint64_t hash) {
+    return entry.descriptor == message.GetDescriptor() &&
+           entry.generation == parse_generation &&
+           entry.binary == input.binary() && entry.hash == hash &&
+           entry.data.size() == input.size() &&
+           !memcmp(entry.data.data(), input.data(), input.size());
+  }
+
+  // Keys |entry| by |data| and allocates its message. Message types of
+  // fuzzers rarely change, so the old message is usually reused.
+  static void Reset(bool binary, const uint8_t* data, size_t size,
+                    uint64_t hash, const protobuf::Message& prototype,
+                    Entry* entry) {
+    if (!entry->message ||
+        entry->message->GetDescriptor() != prototype.GetDescriptor()) {
+      // Allocated on the heap, as arenas of the callers are reset.
+      entry->message.reset(prototype.New());
+    }
+    entry->descriptor = prototype.GetDescriptor();
+    entry->generation = parse_generation;
+    entry->binary = binary;
+    entry->hash = hash;
+    entry->data.assign(data, data + size);
+  }
+
+  const Entry* Find(const InputReader& input, const protobuf::Message& message,
+                    uint64_t hash) const {
+    if (Matches(last_output_, input, message, hash)) return &last_output_;
+    for (const Entry& entry : entries_)
+      if (Matches(entry, input, message, hash)) return &entry;
+    return nullptr;
+  }
+
+  Entry entries_[kEntryCount];
+  size_t next_entry_ = 0;
+  Entry last_output_;
+};
+
+// Mutator state which is kept between fuzzer calls of the thread: the mutator
+// with its scratch buffers, messages to parse inputs into and parsed inputs.
+// Every call reseeds it, so results depend only on the seed and the input, as
+// if the mutator was created for the call.
+class MutatorContext {
+ public:
+  MutatorContext() : mutator_(&random_) {}
+
+  // Reseeds the mutator and restores default settings.
+  Mutator* Reset(unsigned int seed) {
+    random_.seed(seed);
+    mutator_.set_mutation_stack_depth(1);
+    mutator_.set_scheduler(nullptr);
+    return &mutator_;
+  }
+
+  // Returns a message of |prototype| type with unspecified content. Messages
+  // keep memory of nested messages and strings between calls. Crossover needs
+  // two messages, selected by |slot|.
+  protobuf::Message* GetMessage(const protobuf::Message& prototype,
+                                size_t slot) {
+    assert(slot < 2);
+    std::unique_ptr<protobuf::Message>& message = messages_[slot];
+    if (!message || message->GetDescriptor() != prototype.GetDescriptor())
+      message.reset(prototype.New());
+    return message.get();
+  }
+
+  ParsedInputCache* cache() { return &cache_; }
+
+ private:
+  RandomEngine random_;
+  Mutator mutator_;
+  std::unique_ptr<protobuf::Message> messages_[2];
+  ParsedInputCache cache_;
+};
+
+MutatorContext& GetMutatorContext() {
+  thread_local MutatorContext context;
+  return context;
+}
+
 size_t MutateMessage(unsigned int seed, const InputReader& input,
-                     OutputWriter* output, protobuf::Message* message) {
-  RandomEngine random(seed);
-  Mutator mutator(&random);
-  input.Read(message);
-  mutator.Mutate(message, output->size() > input.size()
-                              ? (output->size() - input.size())
-                              : 0);
+                     OutputWriter* output, const protobuf::Message& prototype) {
+  MutatorContext& context = GetMutatorContext();
+  Mutator* mutator = context.Reset(seed);
+  size_t stack_depth = mutation_stack_depth;
+  mutator->set_mutation_stack_depth(stack_depth);
+  MutationScheduler* scheduler = GetThreadScheduler();
+  if (scheduler) {
+    // Output overwrites the input.
+    scheduler->OnInput(input.data(), input.size());
+    mutator->set_scheduler(scheduler);
+  }
+  ParsedInputCache* cache = context.cache();
+  // The binary output of the previous call is mutated again without a copy
+  // and with the index updated by the previous call.
+  std::unique_ptr<MutationIndex> index;
+  protobuf::Message* last_output =
+      cache->FindLastOutput(input, prototype, &index);
+  protobuf::Message* message = last_output;
+  if (!message) {
+    message = context.GetMessage(prototype, 0);
+    cache->Read(input, message);
+  }
+  size_t size_increase_hint =
+      output->size() > input.size() ? (output->size() - input.size()) : 0;
+  // Indexed mutations are not stacked, and the scheduler changes weights
+  // after indexing. Otherwise new inputs are indexed too, so results don't
+  // depend on previous calls.
+  if (stack_depth > 1 || scheduler) {
+    index.reset();
+    mutator->Mutate(message, size_increase_hint);
+  } else {
+    if (!index) index = mutator->CreateIndex(*message);
+    mutator->Mutate(message, size_increase_hint, index.get());
+  }
   if (size_t new_size = output->Write(*message)) {
     assert(new_size <= output->size());
+    if (scheduler) scheduler->OnOutput(output->data(), new_size);
+    // Other outputs are parsed again by the next call, as by a new process.
+    if (OutputParsesBack(input.binary(), *message, new_size))
+      cache->SetLastOutput(input.binary(), output->data(), new_size, message,
+                           std::move(index));
+    else
+      cache->ClearLastOutput();
     return new_size;
   }
+  // The input is kept, but the message doesn't match it anymore.
+  if (last_output) cache->ClearLastOutput();
   return 0;
 }
 
+void MutateMessageBatch(unsigned int seed, const InputReader& input,
+                        OutputWriter* output, size_t count, uint8_t** outputs,
+                        size_t* output_sizes,
+                        const protobuf::Message& prototype) {
+  MutatorContext& context = GetMutatorContext();
+  Mutator* mutator = context.Reset(seed);
+  MutationScheduler* scheduler = GetThreadScheduler();
+  if (scheduler) {
+    scheduler->OnInput(input.data(), input.size());
+    mutator->set_scheduler(scheduler);
+  }
+  protobuf::Message* message = context.GetMessage(prototype, 0);
+  context.cache()->Read(input, message);
+  mutator->MutateBatch(
+      *message,
+      output->size() > input.size() ? (output->size() - input.size()) : 0,
+      count, [&](size_t i, const protobuf::Message& mutant) {
+        output->set_data(outputs[i]);
+        output_sizes[i] = output->Write(mutant);
+        assert(output_sizes[i] <= output->size());
+        if (scheduler && output_sizes[i])
+          scheduler->OnOutput(outputs[i], output_sizes[i]);
+      });
+}
+
 size_t CrossOverMessages(unsigned int seed, const InputReader& input1,
                          const InputReader& input2, OutputWriter* output,
-                         protobuf::Message* message1,
-                         protobuf::Message* message2) {
-  RandomEngine random(seed);
-  Mutator mutator(&random);
-  input1.Read(message1);
-  input2.Read(message2);
-  mutator.CrossOver(*message2, message1);
+                         const protobuf::Message& prototype1,
+                         const protobuf::Message& prototype2) {
+  MutatorContext& context = GetMutatorContext();
+  Mutator* mutator = context.Reset(seed);
+  protobuf::Message* message1 = context.GetMessage(prototype1, 0);
+  protobuf::Message* message2 = context.GetMessage(prototype2, 1);
+  context.cache()->Read(input1, message1);
+  context.cache()->Read(input2, message2);
+  mutator->CrossOver(*message2, message1);
   if (size_t new_size = output->Write(*message1)) {
     assert(new_size <= output->size());
     return new_size;
@@ -122,55 +462,124 @@ size_t CrossOverMessages(unsigned int seed, const InputReader& input1,
 }
 
 size_t MutateTextMessage(uint8_t* data, size_t size, size_t max_size,
-                         unsigned int seed, protobuf::Message* message) {
+                         unsigned int seed, const protobuf::Message* message) {
   TextInputReader input(data, size);
-  TextOutputWriter output(data, max_size);
-  return MutateMessage(seed, input, &output, message);
+  TextOutputWriter output(data, max_size, true);
+  return MutateMessage(seed, input, &output, *message);
+}
+
+void MutateTextMessageBatch(const uint8_t* data, size_t size, size_t max_size,
+                            unsigned int seed, size_t count, uint8_t** outputs,
+                            size_t* output_sizes,
+                            const protobuf::Message* message) {
+  TextInputReader input(data, size);
+  TextOutputWriter output(nullptr, max_size, false);
+  MutateMessageBatch(seed, input, &output, count, outputs, output_sizes,
+                     *message);
 }
 
 size_t CrossOverTextMessages(const uint8_t* data1, size_t size1,
                              const uint8_t* data2, size_t size2, uint8_t* out,
                              size_t max_out_size, unsigned int seed,
-                             protobuf::Message* message1,
-                             protobuf::Message* message2) {
+                             const protobuf::Message* message1,
+                             const protobuf::Message* message2) {
   TextInputReader input1(data1, size1);
   TextInputReader input2(data2, size2);
-  TextOutputWriter output(out, max_out_size);
-  return CrossOverMessages(seed, input1, input2, &output, message1, message2);
+  TextOutputWriter output(out, max_out_size, false);
+  return CrossOverMessages(seed, input1, input2, &output, *message1,
+                           *message2);
 }
 
 size_t MutateBinaryMessage(uint8_t* data, size_t size, size_t max_size,
-                           unsigned int seed, protobuf::Message* message) {
+                           unsigned int seed,
+                           const protobuf::Message* message) {
   BinaryInputReader input(data, size);
   BinaryOutputWriter output(data, max_size);
-  return MutateMessage(seed, input, &output, message);
+  return MutateMessage(seed, input, &output, *message);
+}
+
+void MutateBinaryMessageBatch(const uint8_t* data, size_t size,
+                              size_t max_size, unsigned int seed, size_t count,
+                              uint8_t** outputs, size_t* output_sizes,
+                              const protobuf::Message* message) {
+  BinaryInputReader input(data, size);
+  BinaryOutputWriter output(nullptr, max_size);
+  MutateMessageBatch(seed, input, &output, count, outputs, output_sizes,
+                     *message);
 }
 
 size_t CrossOverBinaryMessages(const uint8_t* data1, size_t size1,
                                const uint8_t* data2, size_t size2, uint8_t* out,
                                size_t max_out_size, unsigned int seed,
-                               protobuf::Message* message1,
-                               protobuf::Message* message2) {
+                               const protobuf::Message* message1,
+                               const protobuf::Message* message2) {
   BinaryInputReader input1(data1, size1);
   BinaryInputReader input2(data2, size2);
   BinaryOutputWriter output(out, max_out_size);
-  return CrossOverMessages(seed, input1, input2, &output, message1, message2);
+  return CrossOverMessages(seed, input1, input2, &output, *message1,
+                           *message2);
 }
 
 }  // namespace
 
+void SetMutationStackDepth(size_t depth) { mutation_stack_depth = depth; }
+
+void SetAdaptiveMutationScheduling(bool enable) {
+  adaptive_mutation_scheduling = enable;
+}
+
+void SetBinaryParseLimits(int recursion_limit, int total_bytes_limit) {
+  binary_recursion_limit = recursion_limit;
+  binary_total_bytes_limit = total_bytes_limit;
+  ++parse_generation;
+}
+
+size_t CustomWireProtoMutator(uint8_t* data, size_t size, size_t max_size,
+                              unsigned int seed,
+                              const protobuf::Message* input) {
+  RandomEngine random(seed);
+  WireMutator mutator(&random);
+  mutator.set_allow_malformed(allow_malformed_wire_mutations);
+  if (mutator.Mutate(input->GetDescriptor(), data, &size, max_size))
+    return size;
+  return CustomProtoMutator(true, data, size, max_size, seed, input);
+}
+
+void SetAllowMalformedWireMutations(bool allow) {
+  allow_malformed_wire_mutations = allow;
+}
+
+ScopedArena::ScopedArena() {
+  ThreadArena& thread_arena = GetThreadArena();
+  ++thread_arena.scopes;
+  arena_ = thread_arena.arena.get();
+}
+
+ScopedArena::~ScopedArena() {
+  ThreadArena& thread_arena = GetThreadArena();
+  if (--thread_arena.scopes == 0) thread_arena.arena->Reset();
+}
+
 size_t CustomProtoMutator(bool binary, uint8_t* data, size_t size,
                           size_t max_size, unsigned int seed,
-                          protobuf::Message* input) {
+                          const protobuf::Message* input) {
   auto mutate = binary ? &MutateBinaryMessage : &MutateTextMessage;
   return mutate(data, size, max_size, seed, input);
 }
 
+void CustomProtoMutatorBatch(bool binary, const uint8_t* data, size_t size,
+                             size_t max_size, unsigned int seed, size_t count,
+                             uint8_t** outputs, size_t* output_sizes,
+                             const protobuf::Message* input) {
+  auto mutate = binary ? &MutateBinaryMessageBatch : &MutateTextMessageBatch;
+  mutate(data, size, max_size, seed, count, outputs, output_sizes, input);
+}
+
 size_t CustomProtoCrossOver(bool binary, const uint8_t* data1, size_t size1,
                             const uint8_t* data2, size_t size2, uint8_t* out,
                             size_t max_out_size, unsigned int seed,
-                            protobuf::Message* input1,
-                            protobuf::Message* input2) {
+                            const protobuf::Message* input1,
+                            const protobuf::Message* input2) {
   auto cross = binary ? &CrossOverBinaryMessages : &CrossOverTextMessages;
   return cross(data1, size1, data2, size2, out, max_out_size, seed, input1,
                input2);
@@ -178,7 +587,7 @@ size_t CustomProtoCrossOver(bool binary, const uint8_t* data1, size_t size1,
 
 bool LoadProtoInput(bool binary, const uint8_t* data, size_t size,
                     protobuf::Message* input) {
-  return binary ? ParseBinaryMessage(data, size, input)
+  return binary ? ParseBinaryMessage(data, size, GetBinaryParseLimits(), input)
                 : ParseTextMessage(data, size, input);
 }
 
@@ -34,13 +34,27 @@
 // significantly slower than mutator, so fuzzing rate may stay unchanged.
 #define DEFINE_BINARY_PROTO_FUZZER(arg) DEFINE_PROTO_FUZZER_IMPL(true, arg)
 
+// Same as above, but inputs of the fuzz target are allocated on a thread-local
+// arena which is reset after every call. This avoids malloc and free of every
+// nested message and string. Mutation and crossover don't need it, they reuse
+// messages of the thread-local context.
+#define DEFINE_ARENA_PROTO_FUZZER(arg) DEFINE_ARENA_TEXT_PROTO_FUZZER(arg)
+#define DEFINE_ARENA_TEXT_PROTO_FUZZER(arg) \
+  DEFINE_ARENA_PROTO_FUZZER_IMPL(false, arg)
+#define DEFINE_ARENA_BINARY_PROTO_FUZZER(arg) \
+  DEFINE_ARENA_PROTO_FUZZER_IMPL(true, arg)
+
+// Same as DEFINE_BINARY_PROTO_FUZZER, but mutates binary inputs directly,
+// without parsing and serialization. See src/wire_mutator.h.
+#define DEFINE_WIRE_PROTO_FUZZER(arg) DEFINE_WIRE_PROTO_FUZZER_IMPL(arg)
+
 // Implementation of macros above.
 #define DEFINE_CUSTOM_PROTO_MUTATOR_IMPL(use_binary, Proto)                    \
   extern "C" size_t LLVMFuzzerCustomMutator(                                   \
       uint8_t* data, size_t size, size_t max_size, unsigned int seed) {        \
     using protobuf_mutator::libfuzzer::CustomProtoMutator;                     \
-    Proto input;                                                               \
-    return CustomProtoMutator(use_binary, data, size, max_size, seed, &input); \
+    return CustomProtoMutator(use_binary, data, size, max_size, seed,          \
+                              &Proto::default_instance());                     \
   }
 
 #define DEFINE_CUSTOM_PROTO_CROSSOVER_IMPL(use_binary, Proto)                 \
@@ -48,10 +62,10 @@
       const uint8_t* data1, size_t size1, const uint8_t* data2, size_t size2, \
       uint8_t* out, size_t max_out_size, unsigned int seed) {                 \
     using protobuf_mutator::libfuzzer::CustomProtoCrossOver;                  \
-    Proto input1;                                                             \
-    Proto input2;                                                             \
     return CustomProtoCrossOver(use_binary, data1, size1, data2, size2, out,  \
-                                max_out_size, seed, &input1, &input2);        \
+                                max_out_size, seed,                           \
+                                &Proto::default_instance(),                   \
+                                &Proto::default_instance());                  \
   }
 
 #define DEFINE_TEST_ONE_PROTO_INPUT_IMPL(use_binary, Proto)                 \
@@ -72,17 +86,125 @@
   DEFINE_TEST_ONE_PROTO_INPUT_IMPL(use_binary, FuzzerProtoType)                \
   static void TestOneProtoInput(arg)
 
+#define DEFINE_WIRE_CUSTOM_PROTO_MUTATOR_IMPL(Proto)                      \
+  extern "C" size_t LLVMFuzzerCustomMutator(                               \
+      uint8_t* data, size_t size, size_t max_size, unsigned int seed) {    \
+    using protobuf_mutator::libfuzzer::CustomWireProtoMutator;             \
+    return CustomWireProtoMutator(data, size, max_size, seed,              \
+                                  &Proto::default_instance());             \
+  }
+
+#define DEFINE_WIRE_PROTO_FUZZER_IMPL(arg)                                     \
+  static void TestOneProtoInput(arg);                                          \
+  using FuzzerProtoType = std::remove_const<std::remove_reference<             \
+      std::function<decltype(TestOneProtoInput)>::argument_type>::type>::type; \
+  DEFINE_WIRE_CUSTOM_PROTO_MUTATOR_IMPL(FuzzerProtoType)                       \
+  DEFINE_CUSTOM_PROTO_CROSSOVER_IMPL(true, FuzzerProtoType)                    \
+  DEFINE_TEST_ONE_PROTO_INPUT_IMPL(true, FuzzerProtoType)                      \
+  static void TestOneProtoInput(arg)
+
+#define DEFINE_ARENA_TEST_ONE_PROTO_INPUT_IMPL(use_binary, Proto)           \
+  extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) { \
+    using protobuf_mutator::libfuzzer::LoadProtoInput;                      \
+    protobuf_mutator::libfuzzer::ScopedArena arena;                         \
+    Proto* input = arena.Create<Proto>();                                   \
+    if (LoadProtoInput(use_binary, data, size, input))                      \
+      TestOneProtoInput(*input);                                            \
+    return 0;                                                               \
+  }
+
+#define DEFINE_ARENA_PROTO_FUZZER_IMPL(use_binary, arg)                        \
+  static void TestOneProtoInput(arg);                                          \
+  using FuzzerProtoType = std::remove_const<std::remove_reference<             \
+      std::function<decltype(TestOneProtoInput)>::argument_type>::type>::type; \
+  DEFINE_CUSTOM_PROTO_MUTATOR_IMPL(use_binary, FuzzerProtoType)                \
+  DEFINE_CUSTOM_PROTO_CROSSOVER_IMPL(use_binary, FuzzerProtoType)              \
+  DEFINE_ARENA_TEST_ONE_PROTO_INPUT_IMPL(use_binary, FuzzerProtoType)          \
+  static void TestOneProtoInput(arg)
+
 namespace protobuf_mutator {
 namespace libfuzzer {
 
+// Provides the thread-local arena for the current fuzzer call. The arena
+// keeps its first block between calls and is reset when the outermost
+// ScopedArena of the thread is destroyed, so messages created with it must not
+// outlive it.
+class ScopedArena {
+ public:
+  ScopedArena();
+  ~ScopedArena();
+
+  ScopedArena(const ScopedArena&) = delete;
+  ScopedArena& operator=(const ScopedArena&) = delete;
+
+  protobuf::Arena* get() const { return arena_; }
+
+  template <class T>
+  T* Create() const {
+    return protobuf::Arena::CreateMessage<T>(arena_);
+  }
+
+ private:
+  protobuf::Arena* arena_;
+};
+
+// Mutates |data| which holds a serialized message of |input| type. |input|
+// only provides the type, the message is parsed into a thread-local context.
+// The context keeps the mutator with its scratch buffers, messages and recent
+// parsed inputs between calls, so inputs which libFuzzer passes again are not
+// parsed again. A binary output of the previous call is mutated in place if
+// parsing it gives the same message, i.e. without map fields and within
+// SetBinaryParseLimits. Its MutationIndex is kept and updated as well, so
+// such chains of mutations don't visit the entire message, except for Copy.
+// The context is reseeded on every call: unless adaptive mutation scheduling
+// is enabled, the output depends only on |data|, |seed| and results of
+// LLVMFuzzerMutate, as if |data| was parsed by a new process.
 size_t CustomProtoMutator(bool binary, uint8_t* data, size_t size,
                           size_t max_size, unsigned int seed,
-                          protobuf::Message* input);
+                          const protobuf::Message* input);
+// Sets number of mutations applied by every call of CustomProtoMutator before
+// the message is serialized. Stacked mutations are selected without
+// MutationIndex. Default is 1.
+void SetMutationStackDepth(size_t depth);
+
+// Enables MutationScheduler in CustomProtoMutator and CustomProtoMutatorBatch.
+// Weights of mutation operators per field type are learned from mutants which
+// libFuzzer keeps in the corpus and passes back for mutation. Scheduler is
+// per thread. Default is false.
+void SetAdaptiveMutationScheduling(bool enable);
+
+// Sets limits of parsing of binary inputs, see BinaryParseLimits in
+// src/binary_format.h. Inputs which exceed the limits are not passed to the
+// fuzz target and are mutated as empty messages. Defaults are 100 and
+// INT_MAX.
+void SetBinaryParseLimits(int recursion_limit, int total_bytes_limit);
+
+// Mutates binary encoded |data| with WireMutator. Falls back to
+// CustomProtoMutator with |input| if data is not a valid encoding of |input|
+// type.
+size_t CustomWireProtoMutator(uint8_t* data, size_t size, size_t max_size,
+                              unsigned int seed,
+                              const protobuf::Message* input);
+
+// Enables malformed encodings in CustomWireProtoMutator. Such inputs test the
+// protobuf parser but never reach the fuzz target. Default is false.
+void SetAllowMalformedWireMutations(bool allow);
+
+// Parses |data| once and writes |count| independent mutants of it into
+// |outputs|. Each of |outputs| must have room for |max_size| bytes.
+// |output_sizes| receives size of each mutant, or 0 if the mutant did not fit.
+// Uses the same context as CustomProtoMutator.
+void CustomProtoMutatorBatch(bool binary, const uint8_t* data, size_t size,
+                             size_t max_size, unsigned int seed, size_t count,
+                             uint8_t** outputs, size_t* output_sizes,
+                             const protobuf::Message* input);
+// Same context as above, the output depends only on |data1|, |data2| and
+// |seed|.
 size_t CustomProtoCrossOver(bool binary, const uint8_t* data1, size_t size1,
                             const uint8_t* data2, size_t size2, uint8_t* out,
                             size_t max_out_size, unsigned int seed,
-                            protobuf::Message* input1,
-                            protobuf::Message* input2);
+                            const protobuf::Message* input1,
+                            const protobuf::Message* input2);
 bool LoadProtoInput(bool binary, const uint8_t* data, size_t size,
                     protobuf::Message* input);
 
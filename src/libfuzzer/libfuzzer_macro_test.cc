@@ -0,0 +1,223 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/libfuzzer/libfuzzer_macro.h"
+
+#include <limits.h>
+
+#include <thread>
+#include <vector>
+
+#include "port/gtest.h"
+#include "src/binary_format.h"
+#include "src/mutator_test_proto2.pb.h"
+#include "src/mutator_test_proto3.pb.h"
+
+// Deterministic replacement of the libFuzzer function. Flips the sign and
+// exponent bits of floats and doubles, and the lowest bit of negative ones.
+// Zero becomes -inf, then the smallest denormal, then NaN with a payload and
+// zero again. Flips a single bit of other values.
+extern "C" size_t LLVMFuzzerMutate(uint8_t* data, size_t size,
+                                   size_t max_size) {
+  if (size == sizeof(float) || size == sizeof(double)) {
+    data[0] ^= data[size - 1] >> 7;
+    data[size - 1] ^= 0xff;
+    data[size - 2] ^= size == sizeof(double) ? 0xf0 : 0x80;
+    return size;
+  }
+  if (size) {
+    data[size / 2] ^= 1 << (size % 8);
+    return size;
+  }
+  if (!max_size) return 0;
+  data[0] = 'a';
+  return 1;
+}
+
+namespace protobuf_mutator {
+namespace libfuzzer {
+namespace {
+
+const size_t kMaxSize = 4096;
+
+using Data = std::vector<uint8_t>;
+
+// Runs |function| on a new thread, which has no state of previous calls.
+template <class Function>
+void RunOnNewThread(const Function& function) {
+  std::thread(function).join();
+}
+
+template <class T>
+Data Mutate(bool binary, const Data& input, unsigned int seed) {
+  Data data = input;
+  data.resize(kMaxSize);
+  T message;
+  data.resize(CustomProtoMutator(binary, data.data(), input.size(), kMaxSize,
+                                 seed, &message));
+  return data;
+}
+
+template <class T>
+std::vector<Data> MutateBatch(bool binary, const Data& input,
+                              unsigned int seed) {
+  std::vector<Data> outputs(4, Data(kMaxSize));
+  uint8_t* data[4];
+  size_t sizes[4];
+  for (size_t i = 0; i < 4; ++i) data[i] = outputs[i].data();
+  T message;
+  CustomProtoMutatorBatch(binary, input.data(), input.size(), kMaxSize, seed, 4,
+                          data, sizes, &message);
+  for (size_t i = 0; i < 4; ++i) outputs[i].resize(sizes[i]);
+  return outputs;
+}
+
+template <class T>
+Data CrossOver(bool binary, const Data& input1, const Data& input2,
+               unsigned int seed) {
+  Data data(kMaxSize);
+  T message1;
+  T message2;
+  data.resize(CustomProtoCrossOver(binary, input1.data(), input1.size(),
+                                   input2.data(), input2.size(), data.data(),
+                                   kMaxSize, seed, &message1, &message2));
+  return data;
+}
+
+class LibFuzzerMacroTest : public testing::TestWithParam<bool> {};
+
+// Results of calls on a thread which made many calls before must be the same
+// as on a new thread.
+TEST_P(LibFuzzerMacroTest, MutateIsDeterministic) {
+  bool binary = GetParam();
+  Data input;
+  for (unsigned int seed = 0; seed < 300; ++seed) {
+    Data expected;
+    RunOnNewThread([&] { expected = Mutate<Msg>(binary, input, seed); });
+    Data output = Mutate<Msg>(binary, input, seed);
+    ASSERT_EQ(expected, output) << seed;
+    // Same seed again, now the input is cached.
+    EXPECT_EQ(expected, Mutate<Msg>(binary, input, seed));
+    // Chain of mutations, as with -mutate_depth.
+    if (!output.empty()) input = output;
+  }
+}
+
+TEST_P(LibFuzzerMacroTest, MutateBatchIsDeterministic) {
+  bool binary = GetParam();
+  Data input;
+  for (unsigned int seed = 0; seed < 100; ++seed) {
+    std::vector<Data> expected;
+    RunOnNewThread([&] { expected = MutateBatch<Msg>(binary, input, seed); });
+    std::vector<Data> outputs = MutateBatch<Msg>(binary, input, seed);
+    ASSERT_EQ(expected, outputs) << seed;
+    for (const Data& output : outputs)
+      if (!output.empty()) input = output;
+  }
+}
+
+TEST_P(LibFuzzerMacroTest, CrossOverIsDeterministic) {
+  bool binary = GetParam();
+  Data input1;
+  Data input2;
+  for (unsigned int seed = 0; seed < 100; ++seed) {
+    input1 = Mutate<Msg>(binary, input1, seed);
+    input2 = Mutate<Msg>(binary, input2, seed + 1000);
+    Data expected;
+    RunOnNewThread(
+        [&] { expected = CrossOver<Msg>(binary, input1, input2, seed); });
+    EXPECT_EQ(expected, CrossOver<Msg>(binary, input1, input2, seed)) << seed;
+  }
+}
+
+// The context switches between message types of the same thread.
+TEST_P(LibFuzzerMacroTest, MessageTypes) {
+  bool binary = GetParam();
+  Data input;
+  Data input3;
+  for (unsigned int seed = 0; seed < 100; ++seed) {
+    Data expected;
+    Data expected3;
+    RunOnNewThread([&] {
+      expected = Mutate<Msg>(binary, input, seed);
+      expected3 = Mutate<Msg3>(binary, input3, seed);
+    });
+    Data output = Mutate<Msg>(binary, input, seed);
+    Data output3 = Mutate<Msg3>(binary, input3, seed);
+    ASSERT_EQ(expected, output) << seed;
+    ASSERT_EQ(expected3, output3) << seed;
+    if (!output.empty()) input = output;
+    if (!output3.empty()) input3 = output3;
+  }
+}
+
+// Output which doesn't fit keeps the input, so the next call must not see the
+// mutated message.
+TEST_P(LibFuzzerMacroTest, OutputDoesNotFit) {
+  bool binary = GetParam();
+  Data input;
+  for (unsigned int seed = 0; seed < 100; ++seed) {
+    Data output = Mutate<Msg>(binary, input, seed);
+    if (output.empty()) continue;
+    input = output;
+    Data data = input;
+    Msg message;
+    CustomProtoMutator(binary, data.data(), input.size(), 1, seed, &message);
+    Data expected;
+    RunOnNewThread([&] { expected = Mutate<Msg>(binary, input, seed); });
+    EXPECT_EQ(expected, Mutate<Msg>(binary, input, seed)) << seed;
+  }
+}
+
+// Text format prints every NaN as nan, so the next call must not mutate the
+// message with the original payload.
+TEST_P(LibFuzzerMacroTest, NonFiniteValues) {
+  bool binary = GetParam();
+  Data input;
+  for (unsigned int seed = 0; seed < 1000; ++seed) {
+    Data expected;
+    RunOnNewThread([&] { expected = Mutate<Msg3>(binary, input, seed); });
+    Data output = Mutate<Msg3>(binary, input, seed);
+    ASSERT_EQ(expected, output) << seed;
+    if (!output.empty()) input = output;
+  }
+}
+
+// Outputs which exceed the limits are parsed as empty messages by the next
+// call, so they must not be reused as parsed.
+TEST_P(LibFuzzerMacroTest, BinaryParseLimits) {
+  bool binary = GetParam();
+  const int kLimits[][2] = {{100, 40}, {3, INT_MAX}};
+  for (const auto& limits : kLimits) {
+    SetBinaryParseLimits(limits[0], limits[1]);
+    Data input;
+    for (unsigned int seed = 0; seed < 300; ++seed) {
+      Data expected;
+      RunOnNewThread([&] { expected = Mutate<Msg>(binary, input, seed); });
+      Data output = Mutate<Msg>(binary, input, seed);
+      ASSERT_EQ(expected, output) << limits[0] << " " << limits[1] << " "
+                                  << seed;
+      if (!output.empty()) input = output;
+    }
+  }
+  BinaryParseLimits defaults;
+  SetBinaryParseLimits(defaults.recursion_limit, defaults.total_bytes_limit);
+}
+
+INSTANTIATE_TEST_CASE_P(Text, LibFuzzerMacroTest, testing::Values(false));
+INSTANTIATE_TEST_CASE_P(Binary, LibFuzzerMacroTest, testing::Values(true));
+
+}  // namespace
+}  // namespace libfuzzer
+}  // namespace protobuf_mutator
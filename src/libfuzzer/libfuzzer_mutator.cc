@@ -21,7 +21,7 @@
 #include <string>
 
 #include "port/protobuf.h"
-#include "src/mutator.h"
+#include "src/basic_mutator.h"
 
 extern "C" size_t LLVMFuzzerMutate(uint8_t*, size_t, size_t)
     __attribute__((weak));
@@ -41,22 +41,37 @@ T MutateValue(T v) {
 
 }  // namespace
 
-int32_t Mutator::MutateInt32(int32_t value) { return MutateValue(value); }
+int32_t MutationPolicy::MutateInt32(int32_t value, RandomEngine* /*random*/) {
+  return MutateValue(value);
+}
 
-int64_t Mutator::MutateInt64(int64_t value) { return MutateValue(value); }
+int64_t MutationPolicy::MutateInt64(int64_t value, RandomEngine* /*random*/) {
+  return MutateValue(value);
+}
 
-uint32_t Mutator::MutateUInt32(uint32_t value) { return MutateValue(value); }
+uint32_t MutationPolicy::MutateUInt32(uint32_t value,
+                                      RandomEngine* /*random*/) {
+  return MutateValue(value);
+}
 
-uint64_t Mutator::MutateUInt64(uint64_t value) { return MutateValue(value); }
+uint64_t MutationPolicy::MutateUInt64(uint64_t value,
+                                      RandomEngine* /*random*/) {
+  return MutateValue(value);
+}
 
-float Mutator::MutateFloat(float value) { return MutateValue(value); }
+float MutationPolicy::MutateFloat(float value, RandomEngine* /*random*/) {
+  return MutateValue(value);
+}
 
-double Mutator::MutateDouble(double value) { return MutateValue(value); }
+double MutationPolicy::MutateDouble(double value, RandomEngine* /*random*/) {
+  return MutateValue(value);
+}
 
-std::string Mutator::MutateString(const std::string& value,
-                                  size_t size_increase_hint) {
+std::string MutationPolicy::MutateString(const std::string& value,
+                                         size_t size_increase_hint,
+                                         RandomEngine* random) {
   // Randomly return empty strings as LLVMFuzzerMutate does not produce them.
-  if (!std::uniform_int_distribution<uint8_t>(0, 20)(*random())) return {};
+  if (GetRandomBool(random, 21)) return {};
   std::string result = value;
   result.resize(value.size() + size_increase_hint);
   if (result.empty()) result.push_back(0);
@@ -66,4 +81,7 @@ std::string Mutator::MutateString(const std::string& value,
 }
 
 }  // namespace libfuzzer
+
+template class BasicMutator<libfuzzer::MutationPolicy>;
+
 }  // namespace protobuf_mutator
@@ -18,30 +18,40 @@
 
 #include <string>
 
-#include "src/mutator.h"
+#include "src/basic_mutator.h"
 
 namespace protobuf_mutator {
 namespace libfuzzer {
 
+// Primitive mutations which use libFuzzer library. Bools and enums use
+// DefaultMutationPolicy.
+struct MutationPolicy : public DefaultMutationPolicy {
+  static int32_t MutateInt32(int32_t value, RandomEngine* random);
+  static int64_t MutateInt64(int64_t value, RandomEngine* random);
+  static uint32_t MutateUInt32(uint32_t value, RandomEngine* random);
+  static uint64_t MutateUInt64(uint64_t value, RandomEngine* random);
+  static float MutateFloat(float value, RandomEngine* random);
+  static double MutateDouble(double value, RandomEngine* random);
+  static std::string MutateString(const std::string& value,
+                                  size_t size_increase_hint,
+                                  RandomEngine* random);
+};
+
 // Overrides protobuf_mutator::Mutator::Mutate* methods with implementation
 // which uses libFuzzer library. protobuf_mutator::Mutator has very basic
 // implementation of this methods.
-class Mutator : public protobuf_mutator::Mutator {
+//
+// Mutate* methods are final, derive a policy from MutationPolicy to change
+// them.
+class Mutator : public BasicMutator<MutationPolicy> {
  public:
-  using protobuf_mutator::Mutator::Mutator;
-
- protected:
-  int32_t MutateInt32(int32_t value) override;
-  int64_t MutateInt64(int64_t value) override;
-  uint32_t MutateUInt32(uint32_t value) override;
-  uint64_t MutateUInt64(uint64_t value) override;
-  float MutateFloat(float value) override;
-  double MutateDouble(double value) override;
-  std::string MutateString(const std::string& value,
-                           size_t size_increase_hint) override;
+  using BasicMutator<MutationPolicy>::BasicMutator;
 };
 
 }  // namespace libfuzzer
+
+extern template class BasicMutator<libfuzzer::MutationPolicy>;
+
 }  // namespace protobuf_mutator
 
 #endif  // SRC_LIBFUZZER_LIBFUZZER_MUTATOR_H_
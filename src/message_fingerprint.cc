@@ -0,0 +1,158 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/message_fingerprint.h"
+
+#include <string.h>
+
+#include <functional>
+#include <string>
+
+#include "src/field_instance.h"
+#include "src/message_info.h"
+
+namespace protobuf_mutator {
+
+using protobuf::Message;
+using protobuf::Reflection;
+
+namespace {
+
+uint64_t Mix(uint64_t value) {
+  value *= 0x9e3779b97f4a7c15ull;
+  return value ^ (value >> 32);
+}
+
+uint64_t Combine(uint64_t hash, uint64_t value) {
+  // Offset avoids Mix(0) == 0, so zero values still change the hash.
+  return Mix(hash ^ Mix(value + 0x632be59bd9b4e019ull));
+}
+
+template <class T>
+uint64_t FloatBits(T value) {
+  // MessageDifferencer compares floats with ==, so 0 and -0 must match.
+  if (value == 0) return 0;
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(value));
+  return bits;
+}
+
+class HashValue : public FieldFunction<HashValue, uint64_t> {
+ public:
+  template <class T>
+  uint64_t ForType(const ConstFieldInstance& field,
+                   MessageFingerprints* fingerprints) const {
+    return Hash(field, fingerprints, static_cast<T*>(nullptr));
+  }
+
+ private:
+  uint64_t Hash(const ConstFieldInstance& field, MessageFingerprints*,
+                double*) const {
+    double value;
+    field.Load(&value);
+    return FloatBits(value);
+  }
+
+  uint64_t Hash(const ConstFieldInstance& field, MessageFingerprints*,
+                float*) const {
+    float value;
+    field.Load(&value);
+    return FloatBits(value);
+  }
+
+  uint64_t Hash(const ConstFieldInstance& field, MessageFingerprints*,
+                ConstFieldInstance::Enum*) const {
+    ConstFieldInstance::Enum value;
+    field.Load(&value);
+    return value.index;
+  }
+
+  uint64_t Hash(const ConstFieldInstance& field, MessageFingerprints*,
+                std::string*) const {
+    std::string scratch;
+    const std::string& value = field.GetStringReference(&scratch);
+    return std::hash<std::string>()(value);
+  }
+
+  uint64_t Hash(const ConstFieldInstance& field,
+                MessageFingerprints* fingerprints,
+                ConstFieldInstance::MessagePtr*) const {
+    return fingerprints->Get(field.GetMessage());
+  }
+
+  template <class T>
+  uint64_t Hash(const ConstFieldInstance& field, MessageFingerprints*,
+                T*) const {
+    T value;
+    field.Load(&value);
+    return static_cast<uint64_t>(value);
+  }
+};
+
+}  // namespace
+
+uint64_t FingerprintBytes(const uint8_t* data, size_t size) {
+  const uint64_t kMul = 0x9e3779b97f4a7c15ull;
+  uint64_t hash = size * kMul;
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    hash = (hash ^ word) * kMul;
+    hash ^= hash >> 29;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data, size);
+  hash = (hash ^ tail) * kMul;
+  return hash ^ (hash >> 32);
+}
+
+uint64_t MessageFingerprints::Get(const Message& message) {
+  auto it = cache_.find(&message);
+  if (it != cache_.end()) return it->second;
+  uint64_t fingerprint = Compute(message);
+  cache_[&message] = fingerprint;
+  return fingerprint;
+}
+
+uint64_t MessageFingerprints::Compute(const Message& message) {
+  const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+  const Reflection* reflection = message.GetReflection();
+  uint64_t hash = 0;
+  // MessageDifferencer compares contents of Any, not the encoding.
+  if (info.descriptor()->full_name() == "google.protobuf.Any") return hash;
+
+  for (const FieldInfo& field : info.fields()) {
+    uint64_t number = field.descriptor->number();
+    if (!field.is_repeated) {
+      if (!reflection->HasField(message, field.descriptor)) continue;
+      uint64_t value = HashValue()(ConstFieldInstance(&message, field), this);
+      hash = Combine(Combine(hash, number), value);
+      continue;
+    }
+    int field_size = reflection->FieldSize(message, field.descriptor);
+    if (!field_size) continue;
+    // MessageDifferencer ignores order of map entries.
+    bool is_map = field.descriptor->is_map();
+    uint64_t elements = 0;
+    for (int i = 0; i < field_size; ++i) {
+      uint64_t element =
+          HashValue()(ConstFieldInstance(&message, field, i), this);
+      elements = is_map ? elements + Mix(element) : Combine(elements, element);
+    }
+    hash = Combine(Combine(Combine(hash, number), field_size), elements);
+  }
+  return hash;
+}
+
+}  // namespace protobuf_mutator
@@ -0,0 +1,48 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MESSAGE_FINGERPRINT_H_
+#define SRC_MESSAGE_FINGERPRINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+
+#include "port/protobuf.h"
+
+namespace protobuf_mutator {
+
+// Structural hashes of messages, memoized per message object, so hashing a
+// message also caches hashes of all its nested messages. Messages equal by
+// MessageDifferencer::Equals have equal fingerprints, so different
+// fingerprints prove that messages are different.
+//
+// Messages must not be modified while their fingerprints are cached.
+class MessageFingerprints {
+ public:
+  uint64_t Get(const protobuf::Message& message);
+
+ private:
+  uint64_t Compute(const protobuf::Message& message);
+
+  std::unordered_map<const protobuf::Message*, uint64_t> cache_;
+};
+
+// Fast non-cryptographic hash of serialized inputs.
+uint64_t FingerprintBytes(const uint8_t* data, size_t size);
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_MESSAGE_FINGERPRINT_H_
@@ -0,0 +1,98 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/message_fingerprint.h"
+
+#include "port/gtest.h"
+#include "src/mutator.h"
+#include "src/mutator_test_proto2.pb.h"
+#include "src/mutator_test_proto3.pb.h"
+
+namespace protobuf_mutator {
+
+using protobuf::util::MessageDifferencer;
+
+TEST(MessageFingerprintsTest, Equal) {
+  Msg message1;
+  message1.set_optional_string("a");
+  message1.add_repeated_msg()->set_optional_double(0.0);
+  message1.mutable_optional_msg()->add_repeated_int32(1);
+  Msg message2 = message1;
+  message2.mutable_repeated_msg(0)->set_optional_double(-0.0);
+  ASSERT_TRUE(MessageDifferencer::Equals(message1, message2));
+
+  MessageFingerprints fingerprints;
+  EXPECT_EQ(fingerprints.Get(message1), fingerprints.Get(message2));
+  EXPECT_EQ(fingerprints.Get(message1.repeated_msg(0)),
+            fingerprints.Get(message2.repeated_msg(0)));
+}
+
+TEST(MessageFingerprintsTest, Different) {
+  Msg message1;
+  Msg message2;
+  message2.set_optional_int32(0);
+  Msg message3;
+  message3.add_repeated_int32(1);
+  message3.add_repeated_int32(2);
+  Msg message4;
+  message4.add_repeated_int32(2);
+  message4.add_repeated_int32(1);
+  Msg message5;
+  message5.mutable_optional_msg()->set_optional_string("a");
+
+  MessageFingerprints fingerprints;
+  for (const Msg* a : {&message1, &message2, &message3, &message4, &message5}) {
+    for (const Msg* b :
+         {&message1, &message2, &message3, &message4, &message5}) {
+      if (a != b) {
+        EXPECT_NE(fingerprints.Get(*a), fingerprints.Get(*b));
+      }
+    }
+  }
+
+  // Proto3 scalars without presence are unset if they have default values.
+  Msg3 message6;
+  Msg3 message7;
+  message7.set_optional_int32(0);
+  EXPECT_EQ(fingerprints.Get(message6), fingerprints.Get(message7));
+}
+
+TEST(MessageFingerprintsTest, EqualMessagesAfterMutations) {
+  RandomEngine random(1);
+  Mutator mutator(&random);
+  for (int i = 0; i < 1000; ++i) {
+    Msg message1;
+    for (int j = 0; j < 10; ++j) mutator.Mutate(&message1, 1000);
+    Msg message2 = message1;
+    MessageFingerprints fingerprints;
+    EXPECT_EQ(fingerprints.Get(message1), fingerprints.Get(message2));
+    // NaN is not equal to itself.
+    if (!MessageDifferencer::Equals(message1, message2)) continue;
+    mutator.Mutate(&message2, 1000);
+    if (!MessageDifferencer::Equals(message1, message2)) {
+      MessageFingerprints new_fingerprints;
+      EXPECT_NE(new_fingerprints.Get(message1), new_fingerprints.Get(message2));
+    }
+  }
+}
+
+TEST(MessageFingerprintsTest, FingerprintBytes) {
+  const uint8_t kData[] = "0123456789abcdef";
+  EXPECT_EQ(FingerprintBytes(kData, 11), FingerprintBytes(kData, 11));
+  EXPECT_NE(FingerprintBytes(kData, 11), FingerprintBytes(kData, 10));
+  EXPECT_NE(FingerprintBytes(kData, 11), FingerprintBytes(kData + 1, 11));
+  EXPECT_NE(FingerprintBytes(kData, 0), FingerprintBytes(kData, 1));
+}
+
+}  // namespace protobuf_mutator
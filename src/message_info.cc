@@ -0,0 +1,215 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/message_info.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include "src/generated_accessors.h"
+
+namespace protobuf_mutator {
+
+using protobuf::Descriptor;
+using protobuf::FieldDescriptor;
+using protobuf::FileDescriptor;
+
+namespace {
+
+using InfoMap =
+    std::unordered_map<const Descriptor*, std::unique_ptr<const MessageInfo>>;
+
+std::mutex& GetInfoMutex() {
+  static std::mutex* mutex = new std::mutex;
+  return *mutex;
+}
+
+InfoMap& GetInfoMap() {
+  static InfoMap* map = new InfoMap;
+  return *map;
+}
+
+// Must be called with GetInfoMutex() locked.
+int GetValueTypeId(const FieldDescriptor& field) {
+  using Key = std::pair<FieldDescriptor::CppType, const void*>;
+  static std::map<Key, int>* ids = new std::map<Key, int>;
+  const void* type = nullptr;
+  if (field.cpp_type() == FieldDescriptor::CPPTYPE_ENUM)
+    type = field.enum_type();
+  else if (field.cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE)
+    type = field.message_type();
+  auto it = ids->emplace(Key(field.cpp_type(), type), ids->size()).first;
+  return it->second;
+}
+
+// Returns true if any message type reachable from |descriptor| has a field
+// which matches |predicate|.
+bool HasReachableField(const Descriptor* descriptor,
+                       bool (*predicate)(const FieldDescriptor&)) {
+  std::set<const Descriptor*> visited = {descriptor};
+  std::vector<const Descriptor*> stack = {descriptor};
+  while (!stack.empty()) {
+    const Descriptor* current = stack.back();
+    stack.pop_back();
+    for (int i = 0; i < current->field_count(); ++i) {
+      const FieldDescriptor* field = current->field(i);
+      if (predicate(*field)) return true;
+      if (field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) continue;
+      if (visited.insert(field->message_type()).second)
+        stack.push_back(field->message_type());
+    }
+  }
+  return false;
+}
+
+bool IsRequiredField(const FieldDescriptor& field) {
+  return field.is_required();
+}
+
+bool IsMapField(const FieldDescriptor& field) { return field.is_map(); }
+
+// Computes max nesting depth of |descriptor|. |depths| memoizes results, with
+// -1 for types which are being visited.
+int GetMaxNestingDepth(const Descriptor* descriptor,
+                       std::map<const Descriptor*, int>* depths) {
+  auto it = depths->find(descriptor);
+  if (it != depths->end()) {
+    // Type is on the stack, so it contains itself.
+    return it->second < 0 ? MessageInfo::kUnboundedDepth : it->second;
+  }
+  (*depths)[descriptor] = -1;
+  int depth = 0;
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    if (field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) continue;
+    int nested = GetMaxNestingDepth(field->message_type(), depths);
+    if (nested == MessageInfo::kUnboundedDepth) {
+      depth = nested;
+      break;
+    }
+    depth = std::max(depth, nested + 1);
+  }
+  (*depths)[descriptor] = depth;
+  return depth;
+}
+
+// Returns accessors of |field| if |accessors| has them for the same type.
+const GeneratedFieldAccessors* FindFieldAccessors(
+    const GeneratedMessageAccessors& accessors, const FieldDescriptor& field) {
+  for (int i = 0; i < accessors.field_count; ++i) {
+    const GeneratedFieldAccessors& candidate = accessors.fields[i];
+    if (candidate.number == field.number() &&
+        candidate.cpp_type == field.cpp_type())
+      return &candidate;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+const int MessageInfo::kUnboundedDepth = std::numeric_limits<int>::max();
+
+bool IsProto3SimpleField(const FieldDescriptor& field) {
+  assert(field.file()->syntax() == FileDescriptor::SYNTAX_PROTO3 ||
+         field.file()->syntax() == FileDescriptor::SYNTAX_PROTO2);
+  return field.file()->syntax() == FileDescriptor::SYNTAX_PROTO3 &&
+         field.cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE &&
+         !field.containing_oneof() && !field.is_repeated();
+}
+
+bool IsUtf8Field(const FieldDescriptor& field) {
+  return field.type() == FieldDescriptor::TYPE_STRING &&
+         field.file()->syntax() == FileDescriptor::SYNTAX_PROTO3;
+}
+
+const MessageInfo& MessageInfo::Get(const Descriptor* descriptor) {
+  // Descriptors are never released by generated pools, so lookups can be
+  // cached per thread without invalidation.
+  thread_local std::unordered_map<const Descriptor*, const MessageInfo*> cache;
+  auto it = cache.find(descriptor);
+  if (it != cache.end()) return *it->second;
+
+  std::lock_guard<std::mutex> lock(GetInfoMutex());
+  std::unique_ptr<const MessageInfo>& info = GetInfoMap()[descriptor];
+  if (!info) info.reset(new MessageInfo(descriptor));
+  cache.emplace(descriptor, info.get());
+  return *info;
+}
+
+const FieldInfo* MessageInfo::FindFieldByTextName(
+    const std::string& name) const {
+  auto it = text_names_.find(name);
+  return it == text_names_.end() ? nullptr : &fields_[it->second];
+}
+
+MessageInfo::MessageInfo(const Descriptor* descriptor)
+    : descriptor_(descriptor) {
+  const GeneratedMessageAccessors* generated =
+      FindGeneratedAccessors(descriptor->full_name());
+  const protobuf::Reflection* generated_reflection =
+      generated ? generated->reflection() : nullptr;
+
+  int field_count = descriptor->field_count();
+  fields_.reserve(field_count);
+  for (int i = 0; i < field_count; ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    FieldInfo info;
+    info.descriptor = field;
+    info.oneof = field->containing_oneof();
+    info.cpp_type = field->cpp_type();
+    info.is_repeated = field->is_repeated();
+    info.is_required = field->is_required();
+    info.is_message = info.cpp_type == FieldDescriptor::CPPTYPE_MESSAGE;
+    info.is_oneof_head = info.oneof && field->index_in_oneof() == 0;
+    info.is_proto3_simple = IsProto3SimpleField(*field);
+    info.enforce_utf8 = IsUtf8Field(*field);
+    info.value_type_id = GetValueTypeId(*field);
+    info.generated =
+        generated ? FindFieldAccessors(*generated, *field) : nullptr;
+    info.generated_reflection = info.generated ? generated_reflection : nullptr;
+    fields_.push_back(info);
+
+    if (info.is_message) message_fields_.push_back(i);
+    if (info.cpp_type == FieldDescriptor::CPPTYPE_STRING)
+      string_fields_.push_back(i);
+    if (info.is_required) required_fields_.push_back(i);
+  }
+
+  // TextFormat::Parser looks up names of other fields first.
+  for (int i = 0; i < field_count; ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    if (field->type() != FieldDescriptor::TYPE_GROUP)
+      text_names_.emplace(field->name(), i);
+  }
+  for (int i = 0; i < field_count; ++i) {
+    const FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == FieldDescriptor::TYPE_GROUP)
+      text_names_.emplace(field->message_type()->name(), i);
+  }
+
+  // Computed from descriptors directly, Get() of nested types would deadlock.
+  requires_initialization_ = HasReachableField(descriptor, IsRequiredField);
+  has_map_fields_ = HasReachableField(descriptor, IsMapField);
+  std::map<const Descriptor*, int> depths;
+  max_nesting_depth_ = GetMaxNestingDepth(descriptor, &depths);
+}
+
+}  // namespace protobuf_mutator
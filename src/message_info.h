@@ -0,0 +1,117 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MESSAGE_INFO_H_
+#define SRC_MESSAGE_INFO_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "port/protobuf.h"
+
+namespace protobuf_mutator {
+
+struct GeneratedFieldAccessors;
+
+// Properties of a single field which mutator needs on every traversal.
+struct FieldInfo {
+  const protobuf::FieldDescriptor* descriptor;
+  // Containing oneof or nullptr.
+  const protobuf::OneofDescriptor* oneof;
+  protobuf::FieldDescriptor::CppType cpp_type;
+  bool is_repeated;
+  bool is_required;
+  bool is_message;
+  // True for the first field of the containing oneof. Mutator handles entire
+  // oneof group on this field.
+  bool is_oneof_head;
+  // Proto3 singular scalar field which has no presence.
+  bool is_proto3_simple;
+  // Proto3 string field which must contain valid UTF-8.
+  bool enforce_utf8;
+  // Dense id of the value type. Fields with the same id have the same
+  // cpp_type, and for enums and messages the same enum_type or message_type,
+  // so values can be copied between them.
+  int value_type_id;
+  // Typed accessors from code generated by src/protoc_plugin, or nullptr. Valid
+  // only for messages with |generated_reflection|.
+  const GeneratedFieldAccessors* generated;
+  const protobuf::Reflection* generated_reflection;
+};
+
+// Immutable per-Descriptor summary of fields, built lazily on first use and
+// shared between threads. Replaces repeated descriptor walks during mutation.
+class MessageInfo {
+ public:
+  // Value of max_nesting_depth() for recursive messages.
+  static const int kUnboundedDepth;
+
+  static const MessageInfo& Get(const protobuf::Descriptor* descriptor);
+
+  const protobuf::Descriptor* descriptor() const { return descriptor_; }
+
+  // All fields in declaration order.
+  const std::vector<FieldInfo>& fields() const { return fields_; }
+
+  // Field named |name| in text format, or nullptr. Groups are named after
+  // their type, as TextFormat prints them.
+  const FieldInfo* FindFieldByTextName(const std::string& name) const;
+
+  // Indices into fields() of message-typed fields.
+  const std::vector<int>& message_fields() const { return message_fields_; }
+
+  // Indices into fields() of string and bytes fields.
+  const std::vector<int>& string_fields() const { return string_fields_; }
+
+  // Indices into fields() of required fields.
+  const std::vector<int>& required_fields() const { return required_fields_; }
+
+  // True if the message or any message type reachable through its fields has
+  // required fields.
+  bool requires_initialization() const { return requires_initialization_; }
+
+  // True if the message or any message type reachable through its fields has
+  // map fields. Parsing of serialized maps drops duplicate keys.
+  bool has_map_fields() const { return has_map_fields_; }
+
+  // Maximal number of nested message levels below the message, 0 if it has no
+  // message fields, or kUnboundedDepth if message types are recursive.
+  int max_nesting_depth() const { return max_nesting_depth_; }
+
+ private:
+  explicit MessageInfo(const protobuf::Descriptor* descriptor);
+  MessageInfo(const MessageInfo&) = delete;
+  MessageInfo& operator=(const MessageInfo&) = delete;
+
+  const protobuf::Descriptor* descriptor_;
+  std::vector<FieldInfo> fields_;
+  std::vector<int> message_fields_;
+  std::vector<int> string_fields_;
+  std::vector<int> required_fields_;
+  std::unordered_map<std::string, int> text_names_;
+  bool requires_initialization_;
+  bool has_map_fields_;
+  int max_nesting_depth_;
+};
+
+// Returns true for proto3 singular scalar fields.
+bool IsProto3SimpleField(const protobuf::FieldDescriptor& field);
+
+// Returns true for proto3 string fields.
+bool IsUtf8Field(const protobuf::FieldDescriptor& field);
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_MESSAGE_INFO_H_
@@ -0,0 +1,91 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/message_info.h"
+
+#include "google/protobuf/struct.pb.h"
+#include "port/gtest.h"
+#include "src/mutator_test_proto2.pb.h"
+#include "src/mutator_test_proto3.pb.h"
+
+namespace protobuf_mutator {
+
+TEST(MessageInfoTest, Fields) {
+  const MessageInfo& info = MessageInfo::Get(Msg::descriptor());
+  EXPECT_EQ(&info, &MessageInfo::Get(Msg::descriptor()));
+  EXPECT_EQ(Msg::descriptor()->field_count(),
+            static_cast<int>(info.fields().size()));
+  for (int i : info.message_fields()) EXPECT_TRUE(info.fields()[i].is_message);
+  EXPECT_FALSE(info.string_fields().empty());
+  for (int i : info.string_fields()) {
+    EXPECT_EQ(protobuf::FieldDescriptor::CPPTYPE_STRING,
+              info.fields()[i].cpp_type);
+  }
+  for (int i : info.required_fields())
+    EXPECT_TRUE(info.fields()[i].is_required);
+}
+
+TEST(MessageInfoTest, FindFieldByTextName) {
+  const MessageInfo& info = MessageInfo::Get(Msg::descriptor());
+  const FieldInfo* field = info.FindFieldByTextName("repeated_msg");
+  ASSERT_NE(nullptr, field);
+  EXPECT_EQ(Msg::descriptor()->FindFieldByName("repeated_msg"),
+            field->descriptor);
+  EXPECT_EQ(nullptr, info.FindFieldByTextName("Repeated_msg"));
+  EXPECT_EQ(nullptr, info.FindFieldByTextName("57"));
+  EXPECT_EQ(nullptr, info.FindFieldByTextName(""));
+}
+
+TEST(MessageInfoTest, ValueTypeId) {
+  const MessageInfo& info = MessageInfo::Get(Msg::descriptor());
+  const protobuf::Descriptor* descriptor = Msg::descriptor();
+  auto id = [&](const char* name) {
+    return info.fields()[descriptor->FindFieldByName(name)->index()]
+        .value_type_id;
+  };
+  EXPECT_EQ(id("optional_int32"), id("repeated_int32"));
+  EXPECT_EQ(id("optional_msg"), id("repeated_msg"));
+  EXPECT_EQ(id("optional_string"), id("optional_bytes"));
+  EXPECT_NE(id("optional_int32"), id("optional_uint32"));
+  EXPECT_NE(id("optional_msg"), id("required_msg"));
+}
+
+TEST(MessageInfoTest, RequiresInitialization) {
+  EXPECT_TRUE(MessageInfo::Get(Msg::descriptor()).requires_initialization());
+  EXPECT_FALSE(
+      MessageInfo::Get(Msg::SubMsg::descriptor()).requires_initialization());
+  EXPECT_FALSE(
+      MessageInfo::Get(SmallMessage::descriptor()).requires_initialization());
+  EXPECT_FALSE(MessageInfo::Get(Msg3::descriptor()).requires_initialization());
+}
+
+TEST(MessageInfoTest, HasMapFields) {
+  EXPECT_TRUE(
+      MessageInfo::Get(protobuf::Struct::descriptor()).has_map_fields());
+  EXPECT_TRUE(MessageInfo::Get(protobuf::Value::descriptor()).has_map_fields());
+  EXPECT_FALSE(MessageInfo::Get(Msg::descriptor()).has_map_fields());
+  EXPECT_FALSE(MessageInfo::Get(Msg3::descriptor()).has_map_fields());
+}
+
+TEST(MessageInfoTest, MaxNestingDepth) {
+  EXPECT_EQ(MessageInfo::kUnboundedDepth,
+            MessageInfo::Get(Msg::descriptor()).max_nesting_depth());
+  EXPECT_EQ(MessageInfo::kUnboundedDepth,
+            MessageInfo::Get(Msg3::descriptor()).max_nesting_depth());
+  EXPECT_EQ(0, MessageInfo::Get(Msg::SubMsg::descriptor()).max_nesting_depth());
+  EXPECT_EQ(0,
+            MessageInfo::Get(EmptyMessage::descriptor()).max_nesting_depth());
+}
+
+}  // namespace protobuf_mutator
@@ -0,0 +1,243 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/mutation_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "src/message_info.h"
+
+namespace protobuf_mutator {
+
+using protobuf::FieldDescriptor;
+using protobuf::Message;
+using protobuf::OneofDescriptor;
+using protobuf::Reflection;
+
+MutationIndex::MutationIndex(const Message& message,
+                             const WeightFunction& weight)
+    : weight_(weight) {
+  AddNode(message, kNone);
+}
+
+void MutationIndex::Reset(const Message& message) {
+  nodes_.clear();
+  children_.clear();
+  AddNode(message, kNone);
+}
+
+size_t MutationIndex::AddNode(const Message& message, size_t parent) {
+  const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+  const Reflection* reflection = message.GetReflection();
+
+  size_t id = nodes_.size();
+  nodes_.push_back(
+      {parent, 0, 0, children_.size(), children_.size(), 0, true, 0, 1});
+  SetOwnState(message, id);
+
+  // Reserve contiguous range for children first, nested nodes append their
+  // own children after it.
+  for (int i : info.message_fields()) {
+    const FieldDescriptor* field = info.fields()[i].descriptor;
+    if (field->is_repeated()) {
+      int field_size = reflection->FieldSize(message, field);
+      for (int j = 0; j < field_size; ++j)
+        children_.push_back({field, j, kNone, 0});
+    } else if (reflection->HasField(message, field)) {
+      children_.push_back({field, -1, kNone, 0});
+    }
+  }
+  size_t children_end = children_.size();
+  nodes_[id].children_end = children_end;
+
+  for (size_t i = nodes_[id].children_begin; i < children_end; ++i) {
+    const Child& child = children_[i];
+    const Message& nested =
+        child.index < 0
+            ? reflection->GetMessage(message, child.field)
+            : reflection->GetRepeatedMessage(message, child.field, child.index);
+    children_[i].node = AddNode(nested, id);
+  }
+  UpdateTotals(id);
+  return id;
+}
+
+void MutationIndex::SetOwnState(const Message& message, size_t node) {
+  const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+  const Reflection* reflection = message.GetReflection();
+  nodes_[node].own_weight = weight_(message);
+  nodes_[node].initialized = true;
+  for (int i : info.required_fields()) {
+    if (!reflection->HasField(message, info.fields()[i].descriptor)) {
+      nodes_[node].initialized = false;
+      break;
+    }
+  }
+}
+
+void MutationIndex::UpdateTotals(size_t node) {
+  Node& parent = nodes_[node];
+  parent.height = 0;
+  parent.uninitialized = !parent.initialized;
+  parent.size = 1;
+  uint64_t weight_end = 0;
+  for (size_t i = parent.children_begin; i < parent.children_end; ++i) {
+    const Node& nested = nodes_[children_[i].node];
+    weight_end += nested.total_weight;
+    children_[i].weight_end = weight_end;
+    parent.height = std::max(parent.height, nested.height + 1);
+    parent.uninitialized += nested.uninitialized;
+    parent.size += nested.size;
+  }
+  parent.total_weight = parent.own_weight + weight_end;
+}
+
+void MutationIndex::Update(const Selection& selection,
+                           const FieldDescriptor* field, int index,
+                           int size_change) {
+  const Message& message = *selection.message;
+  size_t id = selection.node;
+  SetOwnState(message, id);
+
+  const OneofDescriptor* oneof = field->containing_oneof();
+  if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE || oneof) {
+    const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+    const Reflection* reflection = message.GetReflection();
+    // Children are listed again in a new range. Nodes of unchanged messages
+    // are reused, changed messages are indexed below.
+    size_t old_child = nodes_[id].children_begin;
+    size_t old_end = nodes_[id].children_end;
+    size_t begin = children_.size();
+    for (int i : info.message_fields()) {
+      const FieldDescriptor* nested = info.fields()[i].descriptor;
+      size_t old_begin = old_child;
+      while (old_child < old_end && children_[old_child].field == nested)
+        ++old_child;
+      if (nested != field &&
+          (!oneof || nested->containing_oneof() != oneof)) {
+        for (size_t j = old_begin; j < old_child; ++j) {
+          Child child = children_[j];
+          children_.push_back(child);
+        }
+      } else if (!nested->is_repeated()) {
+        if (reflection->HasField(message, nested))
+          children_.push_back({nested, -1, kNone, 0});
+      } else {
+        int field_size = reflection->FieldSize(message, nested);
+        assert(field_size ==
+               static_cast<int>(old_child - old_begin) + size_change);
+        for (int j = 0; j < field_size; ++j) {
+          // Elements after |index| are shifted by |size_change|.
+          bool is_new = j == index && size_change >= 0;
+          size_t node =
+              is_new
+                  ? kNone
+                  : children_[old_begin + (j < index ? j : j - size_change)]
+                        .node;
+          children_.push_back({nested, j, node, 0});
+        }
+      }
+    }
+    size_t end = children_.size();
+    nodes_[id].children_begin = begin;
+    nodes_[id].children_end = end;
+
+    for (size_t i = begin; i < end; ++i) {
+      const Child& child = children_[i];
+      if (child.node != kNone) continue;
+      const Message& nested =
+          child.index < 0 ? reflection->GetMessage(message, child.field)
+                          : reflection->GetRepeatedMessage(
+                                message, child.field, child.index);
+      children_[i].node = AddNode(nested, id);
+    }
+  }
+
+  for (size_t node = id; node != kNone; node = nodes_[node].parent)
+    UpdateTotals(node);
+
+  // Replaced nodes and children stay in place until the most of storage is
+  // unused.
+  size_t size = nodes_.front().size;
+  if (nodes_.size() > 2 * size || children_.size() > 2 * size) Compact();
+}
+
+void MutationIndex::Compact() {
+  std::vector<Node> nodes;
+  std::vector<Child> children;
+  nodes.reserve(nodes_.front().size);
+  children.reserve(nodes_.front().size - 1);
+  CopyNode(0, kNone, &nodes, &children);
+  nodes_.swap(nodes);
+  children_.swap(children);
+}
+
+size_t MutationIndex::CopyNode(size_t node, size_t parent,
+                               std::vector<Node>* nodes,
+                               std::vector<Child>* children) const {
+  size_t id = nodes->size();
+  nodes->push_back(nodes_[node]);
+  (*nodes)[id].parent = parent;
+  // Same layout as AddNode.
+  size_t begin = children->size();
+  children->insert(children->end(),
+                   children_.begin() + nodes_[node].children_begin,
+                   children_.begin() + nodes_[node].children_end);
+  size_t end = children->size();
+  (*nodes)[id].children_begin = begin;
+  (*nodes)[id].children_end = end;
+  for (size_t i = begin; i < end; ++i)
+    (*children)[i].node = CopyNode((*children)[i].node, id, nodes, children);
+  return id;
+}
+
+MutationIndex::Selection MutationIndex::Select(Message* message,
+                                               RandomEngine* random) const {
+  Selection result;
+  if (!total_weight()) return result;
+
+  uint64_t offset = GetRandomUInt64(random, total_weight());
+  size_t id = 0;
+  for (;;) {
+    const Node* node = &nodes_[id];
+    assert(offset < node->total_weight);
+    assert(message->GetDescriptor());
+    if (offset < node->own_weight) break;
+    offset -= node->own_weight;
+
+    auto begin = children_.begin() + node->children_begin;
+    auto end = children_.begin() + node->children_end;
+    auto child = std::upper_bound(
+        begin, end, offset,
+        [](uint64_t value, const Child& c) { return value < c.weight_end; });
+    assert(child != end);
+    if (child != begin) offset -= (child - 1)->weight_end;
+
+    const Reflection* reflection = message->GetReflection();
+    message = child->index < 0
+                  ? reflection->MutableMessage(message, child->field)
+                  : reflection->MutableRepeatedMessage(message, child->field,
+                                                       child->index);
+    id = child->node;
+    ++result.depth;
+  }
+
+  result.message = message;
+  result.offset = offset;
+  result.node = id;
+  return result;
+}
+
+}  // namespace protobuf_mutator
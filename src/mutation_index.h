@@ -0,0 +1,132 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MUTATION_INDEX_H_
+#define SRC_MUTATION_INDEX_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include "port/protobuf.h"
+#include "src/random.h"
+
+namespace protobuf_mutator {
+
+// Tree of candidate weights which mirrors the structure of a message.
+// Selects a message node with probability proportional to the weight of its
+// own candidates in O(depth * log(fanout)), without visiting other nodes.
+//
+// Index does not keep pointers into the message. It can be used with any
+// message structurally equal to the indexed one, e.g. with its copies. After
+// a message is modified, the index must be updated with Update() or Reset().
+// Building the index visits every field of the message, so it pays off only
+// if the index is used for many mutations.
+//
+// Example:
+//   MutationIndex index(message, [](const protobuf::Message& m) {
+//     return m.GetDescriptor()->field_count();
+//   });
+//   MutationIndex::Selection s = index.Select(&copy_of_message, &random);
+class MutationIndex {
+ public:
+  // Returns weight of candidates of the message, not including nested
+  // messages.
+  using WeightFunction = std::function<uint64_t(const protobuf::Message&)>;
+
+  struct Selection {
+    // Selected message node or nullptr if index is empty.
+    protobuf::Message* message = nullptr;
+    // Random offset in [0, own weight of the message).
+    uint64_t offset = 0;
+    // Nesting depth of the message, 0 for the root.
+    int depth = 0;
+    // Node of the message in the index.
+    size_t node = 0;
+  };
+
+  MutationIndex(const protobuf::Message& message, const WeightFunction& weight);
+
+  uint64_t total_weight() const { return nodes_.front().total_weight; }
+
+  // Maximal nesting depth of indexed messages, 0 for the root only.
+  int max_depth() const { return nodes_.front().height; }
+
+  // True if required fields of all indexed messages are set.
+  bool is_initialized() const { return !nodes_.front().uninitialized; }
+
+  Selection Select(protobuf::Message* message, RandomEngine* random) const;
+
+  // Updates the index after |field| of |selection.message| was modified. For
+  // repeated fields |index| is the modified element, and |size_change| is 1
+  // if the element was inserted, -1 if it was erased and 0 if it was
+  // replaced. Other fields, except ones of the same oneof group, and other
+  // elements must be unchanged. Takes O(depth * fanout) and the size of new
+  // nested messages.
+  void Update(const Selection& selection,
+              const protobuf::FieldDescriptor* field, int index,
+              int size_change);
+
+  // Indexes |message| again, e.g. after modification of many fields.
+  void Reset(const protobuf::Message& message);
+
+ private:
+  struct Node {
+    size_t parent;
+    uint64_t own_weight;
+    uint64_t total_weight;
+    // Range in children_.
+    size_t children_begin;
+    size_t children_end;
+    // Nesting depth of the deepest message of the subtree, 0 for leaves.
+    int height;
+    // True if required fields of the message are set.
+    bool initialized;
+    // Number of messages of the subtree without required fields.
+    size_t uninitialized;
+    // Number of messages of the subtree.
+    size_t size;
+  };
+
+  struct Child {
+    const protobuf::FieldDescriptor* field;
+    // Index in the repeated field or -1.
+    int index;
+    size_t node;
+    // Sum of weights of the preceding siblings and this child.
+    uint64_t weight_end;
+  };
+
+  // Parent of the root, and node of a child which is not indexed yet.
+  static const size_t kNone = -1;
+
+  size_t AddNode(const protobuf::Message& message, size_t parent);
+  // Sets own weight and initialization of the |node| from |message|.
+  void SetOwnState(const protobuf::Message& message, size_t node);
+  // Recomputes values of the |node| which depend on its children.
+  void UpdateTotals(size_t node);
+  // Drops nodes and children which are not reachable from the root anymore.
+  void Compact();
+  size_t CopyNode(size_t node, size_t parent, std::vector<Node>* nodes,
+                  std::vector<Child>* children) const;
+
+  WeightFunction weight_;
+  std::vector<Node> nodes_;
+  std::vector<Child> children_;
+};
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_MUTATION_INDEX_H_
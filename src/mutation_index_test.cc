@@ -0,0 +1,169 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/mutation_index.h"
+
+#include <map>
+
+#include "port/gtest.h"
+#include "src/mutator_test_proto2.pb.h"
+
+namespace protobuf_mutator {
+
+const int kRuns = 100000;
+
+uint64_t GetTestWeight(const protobuf::Message& message) {
+  return static_cast<const Msg&>(message).optional_int32();
+}
+
+TEST(MutationIndexTest, Empty) {
+  Msg message;
+  MutationIndex index(message, GetTestWeight);
+  EXPECT_EQ(0u, index.total_weight());
+  RandomEngine random(1);
+  EXPECT_EQ(nullptr, index.Select(&message, &random).message);
+}
+
+TEST(MutationIndexTest, Distribution) {
+  Msg message;
+  message.set_optional_int32(1);
+  message.mutable_optional_msg()->set_optional_int32(2);
+  message.add_repeated_msg()->set_optional_int32(0);
+  message.add_repeated_msg()->set_optional_int32(3);
+  Msg* nested = message.add_repeated_msg();
+  nested->set_optional_int32(4);
+  nested->add_repeated_msg()->set_optional_int32(5);
+
+  MutationIndex index(message, GetTestWeight);
+  EXPECT_EQ(15u, index.total_weight());
+
+  // Index must work with copies of the indexed message.
+  Msg copy = message;
+  RandomEngine random(1);
+  std::map<int, int> counts;
+  for (int i = 0; i < kRuns; ++i) {
+    MutationIndex::Selection selection = index.Select(&copy, &random);
+    ASSERT_NE(nullptr, selection.message);
+    int weight = GetTestWeight(*selection.message);
+    EXPECT_LT(selection.offset, static_cast<uint64_t>(weight));
+    ++counts[weight];
+  }
+
+  EXPECT_EQ(0, counts[0]);
+  for (int weight = 1; weight <= 5; ++weight)
+    EXPECT_NEAR(weight / 15., counts[weight] / static_cast<double>(kRuns),
+                0.01);
+}
+
+TEST(MutationIndexTest, DepthAndInitialization) {
+  Msg message;
+  EXPECT_EQ(0, MutationIndex(message, GetTestWeight).max_depth());
+  EXPECT_FALSE(MutationIndex(message, GetTestWeight).is_initialized());
+
+  Msg* nested = message.add_repeated_msg()->mutable_optional_msg();
+  nested->set_optional_int32(1);
+  MutationIndex index(message, GetTestWeight);
+  EXPECT_EQ(2, index.max_depth());
+  RandomEngine random(1);
+  EXPECT_EQ(2, index.Select(&message, &random).depth);
+
+  SmallMessage small;
+  EXPECT_TRUE(MutationIndex(small, [](const protobuf::Message&) {
+                return 1;
+              }).is_initialized());
+}
+
+// Expects |index| to select the same as a new index of |message|.
+void ExpectSameAsNew(const MutationIndex& index, Msg* message) {
+  MutationIndex expected(*message, GetTestWeight);
+  EXPECT_EQ(expected.total_weight(), index.total_weight());
+  EXPECT_EQ(expected.max_depth(), index.max_depth());
+  EXPECT_EQ(expected.is_initialized(), index.is_initialized());
+  RandomEngine random1(1);
+  RandomEngine random2(1);
+  for (int i = 0; i < 100; ++i) {
+    MutationIndex::Selection a = expected.Select(message, &random1);
+    MutationIndex::Selection b = index.Select(message, &random2);
+    EXPECT_EQ(a.message, b.message);
+    EXPECT_EQ(a.offset, b.offset);
+    EXPECT_EQ(a.depth, b.depth);
+  }
+}
+
+// Returns selection of |target|, which must have non-zero weight.
+MutationIndex::Selection SelectMessage(const MutationIndex& index,
+                                       Msg* message, const Msg* target) {
+  RandomEngine random(1);
+  for (;;) {
+    MutationIndex::Selection selection = index.Select(message, &random);
+    if (selection.message == target) return selection;
+  }
+}
+
+TEST(MutationIndexTest, Update) {
+  Msg message;
+  message.set_optional_int32(1);
+  for (int i = 2; i <= 4; ++i)
+    message.add_repeated_msg()->set_optional_int32(i);
+  MutationIndex index(message, GetTestWeight);
+  const protobuf::Descriptor* descriptor = message.GetDescriptor();
+  const protobuf::FieldDescriptor* repeated_msg =
+      descriptor->FindFieldByName("repeated_msg");
+
+  // Insert the element in the middle.
+  MutationIndex::Selection root = SelectMessage(index, &message, &message);
+  message.add_repeated_msg()->set_optional_int32(5);
+  for (int i = 3; i > 1; --i)
+    message.mutable_repeated_msg()->SwapElements(i, i - 1);
+  index.Update(root, repeated_msg, 1, 1);
+  ExpectSameAsNew(index, &message);
+
+  // Erase and replace elements.
+  message.mutable_repeated_msg()->DeleteSubrange(0, 1);
+  index.Update(root, repeated_msg, 0, -1);
+  ExpectSameAsNew(index, &message);
+  message.mutable_repeated_msg(2)->add_repeated_msg()->set_optional_int32(6);
+  index.Update(root, repeated_msg, 2, 0);
+  ExpectSameAsNew(index, &message);
+
+  // Nested scalar field.
+  Msg* nested = message.mutable_repeated_msg(1);
+  MutationIndex::Selection selection = SelectMessage(index, &message, nested);
+  EXPECT_EQ(1, selection.depth);
+  nested->set_optional_int32(7);
+  index.Update(selection, descriptor->FindFieldByName("optional_int32"), -1,
+               0);
+  ExpectSameAsNew(index, &message);
+
+  // Message in a oneof group replaced by another field of the group.
+  message.mutable_oneof_msg()->set_optional_int32(8);
+  index.Update(root, descriptor->FindFieldByName("oneof_msg"), -1, 0);
+  ExpectSameAsNew(index, &message);
+  EXPECT_EQ(2, index.max_depth());
+  message.set_oneof_double(1);
+  index.Update(root, descriptor->FindFieldByName("oneof_double"), -1, 0);
+  ExpectSameAsNew(index, &message);
+
+  // Many updates of the same node leave unused storage.
+  for (int i = 0; i < 100; ++i) {
+    message.mutable_optional_msg()->set_optional_int32(i + 1);
+    index.Update(root, descriptor->FindFieldByName("optional_msg"), -1, 0);
+  }
+  ExpectSameAsNew(index, &message);
+
+  index.Reset(message);
+  ExpectSameAsNew(index, &message);
+}
+
+}  // namespace protobuf_mutator
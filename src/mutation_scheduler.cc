@@ -0,0 +1,105 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/mutation_scheduler.h"
+
+#include <algorithm>
+
+#include "src/message_fingerprint.h"
+
+namespace protobuf_mutator {
+
+namespace {
+
+// Number of remembered mutants.
+const size_t kMutantSlots = 1 << 16;
+// Uses which pull success rate of an arm towards the rate of all arms.
+const double kPriorUses = 256;
+// Counters are halved after this many uses, so weights follow the campaign.
+const uint64_t kDecayUses = 1 << 16;
+// Factors are recomputed after this many uses, and after every reward.
+const uint64_t kUpdateUses = 256;
+
+}  // namespace
+
+const uint64_t MutationScheduler::kScale;
+
+MutationScheduler::MutationScheduler() : mutants_(kMutantSlots) {
+  static_assert(kArmCount <= 64, "Arms must fit into Mutant::arms");
+  std::fill(factors_, factors_ + kArmCount, kScale);
+}
+
+void MutationScheduler::OnMutation(
+    Operator op, protobuf::FieldDescriptor::CppType cpp_type) {
+  int arm = GetArm(op, cpp_type);
+  pending_arms_ |= 1ull << arm;
+  ++uses_[arm];
+  ++total_uses_;
+  if (++uses_since_update_ >= kUpdateUses) UpdateFactors();
+}
+
+void MutationScheduler::OnInput(const uint8_t* data, size_t size) {
+  pending_arms_ = 0;
+  uint64_t fingerprint = FingerprintBytes(data, size);
+  bool is_last_output = fingerprint == last_output_;
+  last_output_ = 0;
+  if (is_last_output) return;
+  Mutant& mutant = mutants_[fingerprint % mutants_.size()];
+  if (mutant.fingerprint != fingerprint || !mutant.arms) return;
+  for (int arm = 0; arm < kArmCount; ++arm) {
+    if (mutant.arms & (1ull << arm)) {
+      ++rewards_[arm];
+      ++total_rewards_;
+    }
+  }
+  // Credit only the first time the input is selected.
+  mutant.arms = 0;
+  UpdateFactors();
+}
+
+void MutationScheduler::OnOutput(const uint8_t* data, size_t size) {
+  last_output_ = FingerprintBytes(data, size);
+  if (pending_arms_)
+    mutants_[last_output_ % mutants_.size()] = {last_output_, pending_arms_};
+  pending_arms_ = 0;
+}
+
+void MutationScheduler::UpdateFactors() {
+  uses_since_update_ = 0;
+  if (total_uses_ >= kDecayUses) {
+    for (int arm = 0; arm < kArmCount; ++arm) {
+      uses_[arm] /= 2;
+      rewards_[arm] /= 2;
+    }
+    total_uses_ /= 2;
+    total_rewards_ /= 2;
+  }
+
+  if (!total_rewards_) {
+    std::fill(factors_, factors_ + kArmCount, kScale);
+    return;
+  }
+  // Success rate of every arm is estimated with kPriorUses virtual uses at the
+  // rate of all arms, so rarely used arms stay close to kScale.
+  double rate = static_cast<double>(total_rewards_) / total_uses_;
+  for (int arm = 0; arm < kArmCount; ++arm) {
+    double arm_rate =
+        (rewards_[arm] + rate * kPriorUses) / (uses_[arm] + kPriorUses);
+    double factor = kScale * arm_rate / rate;
+    factors_[arm] = std::min<double>(
+        kScale * 8, std::max<double>(kScale / 8, factor));
+  }
+}
+
+}  // namespace protobuf_mutator
@@ -0,0 +1,113 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MUTATION_SCHEDULER_H_
+#define SRC_MUTATION_SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "port/protobuf.h"
+
+namespace protobuf_mutator {
+
+// Learns weights of mutations from corpus feedback. An arm of the scheduler is
+// a pair of mutation operator and cpp_type of the mutated field.
+//
+// The fuzzing engine keeps only inputs with new coverage, and those inputs
+// later come back to the mutator as inputs to mutate. Scheduler remembers
+// fingerprints of produced mutants together with arms which produced them and
+// credits the arms when the fingerprint reappears as an input. Every arm gets
+// a weight factor proportional to its estimated success rate, relative to the
+// success rate of all arms.
+//
+// Usage:
+//   scheduler.OnInput(data, size);
+//   mutator.set_scheduler(&scheduler);
+//   mutator.Mutate(&message, max_size - size);
+//   scheduler.OnOutput(data, new_size);
+//
+// Not thread-safe. Use one instance per thread.
+class MutationScheduler {
+ public:
+  // Mutations of protobuf_mutator::Mutator.
+  enum Operator {
+    kAdd,
+    kMutate,
+    kDelete,
+    kCopy,
+    kOperatorCount,
+  };
+
+  // Weight factor of an arm without feedback.
+  static const uint64_t kScale = 1 << 10;
+
+  MutationScheduler();
+
+  // Returns weight factor of mutating a field of |cpp_type| with |op|, in
+  // [kScale / 8, kScale * 8].
+  uint64_t GetFactor(Operator op,
+                     protobuf::FieldDescriptor::CppType cpp_type) const {
+    return factors_[GetArm(op, cpp_type)];
+  }
+
+  // Called by the mutator for every applied mutation.
+  void OnMutation(Operator op, protobuf::FieldDescriptor::CppType cpp_type);
+
+  // Called with every input before mutation. Credits mutations which produced
+  // the input, if it's a mutant remembered by OnOutput. Forgets mutations
+  // not followed by OnOutput.
+  void OnInput(const uint8_t* data, size_t size);
+
+  // Remembers mutations applied since the last OnInput or OnOutput as the
+  // producers of |data|.
+  void OnOutput(const uint8_t* data, size_t size);
+
+ private:
+  static const int kCppTypeCount = protobuf::FieldDescriptor::MAX_CPPTYPE;
+  static const int kArmCount = kOperatorCount * kCppTypeCount;
+
+  struct Mutant {
+    uint64_t fingerprint;
+    // Bit mask of arms.
+    uint64_t arms;
+  };
+
+  static int GetArm(Operator op, protobuf::FieldDescriptor::CppType cpp_type) {
+    return op * kCppTypeCount + (cpp_type - 1);
+  }
+
+  void UpdateFactors();
+
+  uint64_t uses_[kArmCount] = {};
+  uint64_t rewards_[kArmCount] = {};
+  uint64_t total_uses_ = 0;
+  uint64_t total_rewards_ = 0;
+  uint64_t factors_[kArmCount];
+  uint64_t uses_since_update_ = 0;
+
+  // Arms applied to the current mutant.
+  uint64_t pending_arms_ = 0;
+  // Fingerprint of the last mutant if no input was seen since. The engine may
+  // mutate the mutant again right away, without adding it to the corpus.
+  uint64_t last_output_ = 0;
+  // Direct-mapped by fingerprint, newer mutants replace older ones.
+  std::vector<Mutant> mutants_;
+};
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_MUTATION_SCHEDULER_H_
@@ -0,0 +1,148 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/mutation_scheduler.h"
+
+#include <memory>
+#include <string>
+
+#include "port/gtest.h"
+#include "src/mutation_index.h"
+#include "src/mutator.h"
+#include "src/mutator_test_proto2.pb.h"
+
+namespace protobuf_mutator {
+
+using protobuf::FieldDescriptor;
+
+const uint64_t kScale = MutationScheduler::kScale;
+
+void Input(const std::string& data, MutationScheduler* scheduler) {
+  scheduler->OnInput(reinterpret_cast<const uint8_t*>(data.data()),
+                     data.size());
+}
+
+void Output(const std::string& data, MutationScheduler* scheduler) {
+  scheduler->OnOutput(reinterpret_cast<const uint8_t*>(data.data()),
+                      data.size());
+}
+
+TEST(MutationSchedulerTest, Default) {
+  MutationScheduler scheduler;
+  for (int op = 0; op < MutationScheduler::kOperatorCount; ++op) {
+    for (int type = 1; type <= FieldDescriptor::MAX_CPPTYPE; ++type) {
+      EXPECT_EQ(kScale, scheduler.GetFactor(
+                            static_cast<MutationScheduler::Operator>(op),
+                            static_cast<FieldDescriptor::CppType>(type)));
+    }
+  }
+}
+
+TEST(MutationSchedulerTest, CreditsKeptMutants) {
+  MutationScheduler scheduler;
+  for (int i = 0; i < 1000; ++i) {
+    Input("seed", &scheduler);
+    scheduler.OnMutation(MutationScheduler::kAdd,
+                         FieldDescriptor::CPPTYPE_INT32);
+    Output("add" + std::to_string(i), &scheduler);
+
+    Input("seed", &scheduler);
+    scheduler.OnMutation(MutationScheduler::kDelete,
+                         FieldDescriptor::CPPTYPE_STRING);
+    Output("delete" + std::to_string(i), &scheduler);
+
+    // Every tenth Add mutant is kept in the corpus.
+    if (i % 10 == 0) Input("add" + std::to_string(i), &scheduler);
+  }
+
+  EXPECT_GT(scheduler.GetFactor(MutationScheduler::kAdd,
+                                FieldDescriptor::CPPTYPE_INT32),
+            kScale * 3 / 2);
+  EXPECT_LT(scheduler.GetFactor(MutationScheduler::kDelete,
+                                FieldDescriptor::CPPTYPE_STRING),
+            kScale / 4);
+  // Unused arms stay neutral.
+  EXPECT_EQ(kScale, scheduler.GetFactor(MutationScheduler::kCopy,
+                                        FieldDescriptor::CPPTYPE_INT32));
+}
+
+TEST(MutationSchedulerTest, IgnoresRemutatedOutput) {
+  MutationScheduler scheduler;
+  for (int i = 0; i < 1000; ++i) {
+    scheduler.OnMutation(MutationScheduler::kMutate,
+                         FieldDescriptor::CPPTYPE_DOUBLE);
+    std::string mutant = std::to_string(i);
+    Output(mutant, &scheduler);
+    // Engine mutates the last mutant again, it's not in the corpus.
+    Input(mutant, &scheduler);
+  }
+  EXPECT_EQ(kScale, scheduler.GetFactor(MutationScheduler::kMutate,
+                                        FieldDescriptor::CPPTYPE_DOUBLE));
+}
+
+TEST(MutationSchedulerTest, CreditsOnce) {
+  MutationScheduler scheduler1;
+  MutationScheduler scheduler2;
+  for (MutationScheduler* scheduler : {&scheduler1, &scheduler2}) {
+    for (int i = 0; i < 100; ++i) {
+      scheduler->OnMutation(MutationScheduler::kMutate,
+                            FieldDescriptor::CPPTYPE_ENUM);
+      Output(std::to_string(i), scheduler);
+    }
+    scheduler->OnMutation(MutationScheduler::kCopy,
+                          FieldDescriptor::CPPTYPE_ENUM);
+    Output("mutant", scheduler);
+    Input("other", scheduler);
+    Input("mutant", scheduler);
+  }
+  uint64_t factor = scheduler1.GetFactor(MutationScheduler::kCopy,
+                                         FieldDescriptor::CPPTYPE_ENUM);
+  EXPECT_GT(factor, kScale);
+
+  Input("mutant", &scheduler2);
+  Input("mutant", &scheduler2);
+  EXPECT_EQ(factor, scheduler2.GetFactor(MutationScheduler::kCopy,
+                                         FieldDescriptor::CPPTYPE_ENUM));
+}
+
+TEST(MutationSchedulerTest, Mutator) {
+  RandomEngine random(1);
+  Mutator mutator(&random);
+  MutationScheduler scheduler;
+  mutator.set_scheduler(&scheduler);
+
+  Msg message;
+  std::string input;
+  for (int i = 0; i < 1000; ++i) {
+    Input(input, &scheduler);
+    mutator.Mutate(&message, 100);
+    ASSERT_TRUE(message.IsInitialized());
+    std::string output = message.ShortDebugString();
+    Output(output, &scheduler);
+    // Keep every other mutant.
+    if (i % 2) input = output;
+  }
+
+  // Index may have weights different from the scheduler.
+  std::unique_ptr<MutationIndex> index = mutator.CreateIndex(message);
+  for (int i = 0; i < 1000; ++i) {
+    Msg copy = message;
+    scheduler.OnMutation(MutationScheduler::kMutate,
+                         FieldDescriptor::CPPTYPE_STRING);
+    mutator.Mutate(&copy, 100, *index);
+    ASSERT_TRUE(copy.IsInitialized());
+  }
+}
+
+}  // namespace protobuf_mutator
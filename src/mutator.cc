@@ -16,12 +16,18 @@
 #include "src/mutator.h"
 
 #include <algorithm>
-#include <functional>
 #include <map>
+#include <numeric>
 #include <random>
 #include <string>
+#include <vector>
 
+#include "src/basic_mutator.h"
 #include "src/field_instance.h"
+#include "src/message_fingerprint.h"
+#include "src/message_info.h"
+#include "src/mutation_index.h"
+#include "src/mutation_scheduler.h"
 #include "src/utf8_fix.h"
 #include "src/weighted_reservoir_sampler.h"
 
@@ -29,17 +35,16 @@ namespace protobuf_mutator {
 
 using protobuf::Descriptor;
 using protobuf::FieldDescriptor;
-using protobuf::FileDescriptor;
 using protobuf::Message;
 using protobuf::OneofDescriptor;
 using protobuf::Reflection;
 using protobuf::util::MessageDifferencer;
-using std::placeholders::_1;
 
 namespace {
 
 const int kMaxInitializeDepth = 200;
 const uint64_t kDefaultMutateWeight = 1000000;
+const int kMaxIndexAttempts = 10;
 
 enum class Mutation {
   None,
@@ -52,39 +57,6 @@ enum class Mutation {
   // Clone,  // Adds new field with value copied from another field.
 };
 
-// Return random integer from [0, count)
-size_t GetRandomIndex(RandomEngine* random, size_t count) {
-  assert(count > 0);
-  if (count == 1) return 0;
-  return std::uniform_int_distribution<size_t>(0, count - 1)(*random);
-}
-
-// Flips random bit in the buffer.
-void FlipBit(size_t size, uint8_t* bytes, RandomEngine* random) {
-  size_t bit = GetRandomIndex(random, size * 8);
-  bytes[bit / 8] ^= (1u << (bit % 8));
-}
-
-// Flips random bit in the value.
-template <class T>
-T FlipBit(T value, RandomEngine* random) {
-  FlipBit(sizeof(value), reinterpret_cast<uint8_t*>(&value), random);
-  return value;
-}
-
-// Return true with probability about 1-of-n.
-bool GetRandomBool(RandomEngine* random, size_t n = 2) {
-  return GetRandomIndex(random, n) == 0;
-}
-
-bool IsProto3SimpleField(const FieldDescriptor& field) {
-  assert(field.file()->syntax() == FileDescriptor::SYNTAX_PROTO3 ||
-         field.file()->syntax() == FileDescriptor::SYNTAX_PROTO2);
-  return field.file()->syntax() == FileDescriptor::SYNTAX_PROTO3 &&
-         field.cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE &&
-         !field.containing_oneof() && !field.is_repeated();
-}
-
 struct CreateDefaultField : public FieldFunction<CreateDefaultField> {
   template <class T>
   void ForType(const FieldInstance& field) const {
@@ -101,408 +73,923 @@ struct DeleteField : public FieldFunction<DeleteField> {
   }
 };
 
-struct CopyField : public FieldFunction<CopyField> {
+// Strings and messages are copied directly from the source, other values
+// through Load and Store.
+class CopyField : public FieldFunction<CopyField> {
+ public:
   template <class T>
   void ForType(const ConstFieldInstance& source,
                const FieldInstance& field) const {
+    Copy(source, field, static_cast<T*>(nullptr));
+  }
+
+ private:
+  void Copy(const ConstFieldInstance& source, const FieldInstance& field,
+            std::string*) const {
+    field.StoreFrom(source);
+  }
+
+  void Copy(const ConstFieldInstance& source, const FieldInstance& field,
+            ConstFieldInstance::MessagePtr*) const {
+    field.StoreFrom(source);
+  }
+
+  template <class T>
+  void Copy(const ConstFieldInstance& source, const FieldInstance& field,
+            T*) const {
     T value;
     source.Load(&value);
     field.Store(value);
   }
 };
 
-struct AppendField : public FieldFunction<AppendField> {
+class AppendField : public FieldFunction<AppendField> {
+ public:
   template <class T>
   void ForType(const ConstFieldInstance& source,
                const FieldInstance& field) const {
+    Append(source, field, static_cast<T*>(nullptr));
+  }
+
+ private:
+  void Append(const ConstFieldInstance& source, const FieldInstance& field,
+              std::string*) const {
+    field.CreateFrom(source);
+  }
+
+  void Append(const ConstFieldInstance& source, const FieldInstance& field,
+              ConstFieldInstance::MessagePtr*) const {
+    field.CreateFrom(source);
+  }
+
+  template <class T>
+  void Append(const ConstFieldInstance& source, const FieldInstance& field,
+              T*) const {
     T value;
     source.Load(&value);
     field.Create(value);
   }
 };
 
+// Compares values without copies of strings and messages. Messages are
+// compared structurally only if their fingerprints match.
 class IsEqualValueField : public FieldFunction<IsEqualValueField, bool> {
  public:
   template <class T>
-  bool ForType(const ConstFieldInstance& a, const ConstFieldInstance& b) const {
-    T aa;
+  bool ForType(const ConstFieldInstance& a, const ConstFieldInstance& b,
+               MessageFingerprints* fingerprints) const {
+    return IsEqual(a, b, fingerprints, static_cast<T*>(nullptr));
+  }
+
+ private:
+  bool IsEqual(const ConstFieldInstance& a, const ConstFieldInstance& b,
+               MessageFingerprints*, ConstFieldInstance::Enum*) const {
+    ConstFieldInstance::Enum aa;
     a.Load(&aa);
-    T bb;
+    ConstFieldInstance::Enum bb;
     b.Load(&bb);
-    return IsEqual(aa, bb);
+    assert(aa.count == bb.count);
+    return aa.index == bb.index;
   }
 
- private:
-  bool IsEqual(const ConstFieldInstance::Enum& a,
-               const ConstFieldInstance::Enum& b) const {
-    assert(a.count == b.count);
-    return a.index == b.index;
+  bool IsEqual(const ConstFieldInstance& a, const ConstFieldInstance& b,
+               MessageFingerprints*, std::string*) const {
+    std::string aa;
+    std::string bb;
+    return a.GetStringReference(&aa) == b.GetStringReference(&bb);
   }
 
-  bool IsEqual(const std::unique_ptr<protobuf::Message>& a,
-               const std::unique_ptr<protobuf::Message>& b) const {
-    return MessageDifferencer::Equals(*a, *b);
+  bool IsEqual(const ConstFieldInstance& a, const ConstFieldInstance& b,
+               MessageFingerprints* fingerprints,
+               ConstFieldInstance::MessagePtr*) const {
+    const Message& aa = a.GetMessage();
+    const Message& bb = b.GetMessage();
+    if (&aa == &bb) return true;
+    return fingerprints->Get(aa) == fingerprints->Get(bb) &&
+           MessageDifferencer::Equals(aa, bb);
   }
 
   template <class T>
-  bool IsEqual(const T& a, const T& b) const {
-    return a == b;
+  bool IsEqual(const ConstFieldInstance& a, const ConstFieldInstance& b,
+               MessageFingerprints*, T*) const {
+    T aa;
+    a.Load(&aa);
+    T bb;
+    b.Load(&bb);
+    return aa == bb;
   }
 };
 
-// Selects random field and mutation from the given proto message.
-class MutationSampler {
- public:
-  MutationSampler(bool keep_initialized, RandomEngine* random, Message* message)
-      : keep_initialized_(keep_initialized), random_(random), sampler_(random) {
-    Sample(message);
-    assert(mutation() != Mutation::None ||
-           message->GetDescriptor()->field_count() == 0);
-  }
-
-  // Returns selected field.
-  const FieldInstance& field() const { return sampler_.selected().field; }
-
-  // Returns selected mutation.
-  Mutation mutation() const { return sampler_.selected().mutation; }
+// Field level mutation which is not yet bound to particular field of oneof
+// group or element of repeated field.
+struct Candidate {
+  Candidate() = default;
+  Candidate(const FieldInfo* f, Mutation m) : field(f), mutation(m) {}
 
- private:
-  void Sample(Message* message) {
-    const Descriptor* descriptor = message->GetDescriptor();
-    const Reflection* reflection = message->GetReflection();
+  const FieldInfo* field = nullptr;
+  Mutation mutation = Mutation::None;
+};
 
-    int field_count = descriptor->field_count();
-    for (int i = 0; i < field_count; ++i) {
-      const FieldDescriptor* field = descriptor->field(i);
-      if (const OneofDescriptor* oneof = field->containing_oneof()) {
-        // Handle entire oneof group on the first field.
-        if (field->index_in_oneof() == 0) {
-          assert(oneof->field_count());
-          const FieldDescriptor* current_field =
-              reflection->GetOneofFieldDescriptor(*message, oneof);
-          for (;;) {
-            const FieldDescriptor* add_field =
-                oneof->field(GetRandomIndex(random_, oneof->field_count()));
-            if (add_field != current_field) {
-              sampler_.Try(kDefaultMutateWeight,
-                           {{message, add_field}, Mutation::Add});
-              break;
-            }
-            if (oneof->field_count() < 2) break;
-          }
-          if (current_field) {
-            if (current_field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) {
-              sampler_.Try(kDefaultMutateWeight,
-                           {{message, current_field}, Mutation::Mutate});
-            }
-            sampler_.Try(kDefaultMutateWeight,
-                         {{message, current_field}, Mutation::Delete});
-            sampler_.Try(kDefaultMutateWeight,
-                         {{message, current_field}, Mutation::Copy});
-          }
-        }
-      } else {
-        if (field->is_repeated()) {
-          int field_size = reflection->FieldSize(*message, field);
-          sampler_.Try(
-              kDefaultMutateWeight,
-              {{message, field, GetRandomIndex(random_, field_size + 1)},
-               Mutation::Add});
-
-          if (field_size) {
-            size_t random_index = GetRandomIndex(random_, field_size);
-            if (field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) {
-              sampler_.Try(kDefaultMutateWeight,
-                           {{message, field, random_index}, Mutation::Mutate});
-            }
-            sampler_.Try(kDefaultMutateWeight,
-                         {{message, field, random_index}, Mutation::Delete});
-            sampler_.Try(kDefaultMutateWeight,
-                         {{message, field, random_index}, Mutation::Copy});
-          }
-        } else {
-          if (reflection->HasField(*message, field) ||
-              IsProto3SimpleField(*field)) {
-            if (field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE)
-              sampler_.Try(kDefaultMutateWeight,
-                           {{message, field}, Mutation::Mutate});
-            if (!IsProto3SimpleField(*field) &&
-                (!field->is_required() || !keep_initialized_)) {
-              sampler_.Try(kDefaultMutateWeight,
-                           {{message, field}, Mutation::Delete});
-            }
-            sampler_.Try(kDefaultMutateWeight,
-                         {{message, field}, Mutation::Copy});
-          } else {
-            sampler_.Try(kDefaultMutateWeight,
-                         {{message, field}, Mutation::Add});
-          }
-        }
+// Calls callback for every mutation candidate of the message, not including
+// candidates of nested messages. Does not use random numbers, so it can be
+// used to count candidates as well.
+// Candidates of the oneof group refer to the head field for Add, and to the
+// current field otherwise.
+template <class Callback>
+void ForEachCandidate(const Message& message, bool keep_initialized,
+                      Callback callback) {
+  const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+  const Reflection* reflection = message.GetReflection();
+
+  for (const FieldInfo& field : info.fields()) {
+    if (const OneofDescriptor* oneof = field.oneof) {
+      // Handle entire oneof group on the first field.
+      if (!field.is_oneof_head) continue;
+      assert(oneof->field_count());
+      const FieldDescriptor* current_field =
+          reflection->GetOneofFieldDescriptor(message, oneof);
+      if (!current_field || oneof->field_count() > 1)
+        callback(Candidate(&field, Mutation::Add));
+      if (current_field) {
+        const FieldInfo* current = &info.fields()[current_field->index()];
+        if (!current->is_message)
+          callback(Candidate(current, Mutation::Mutate));
+        callback(Candidate(current, Mutation::Delete));
+        callback(Candidate(current, Mutation::Copy));
       }
-
-      if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
-        if (field->is_repeated()) {
-          const int field_size = reflection->FieldSize(*message, field);
-          for (int j = 0; j < field_size; ++j)
-            Sample(reflection->MutableRepeatedMessage(message, field, j));
-        } else if (reflection->HasField(*message, field)) {
-          Sample(reflection->MutableMessage(message, field));
-        }
+    } else if (field.is_repeated) {
+      callback(Candidate(&field, Mutation::Add));
+      if (reflection->FieldSize(message, field.descriptor)) {
+        if (!field.is_message) callback(Candidate(&field, Mutation::Mutate));
+        callback(Candidate(&field, Mutation::Delete));
+        callback(Candidate(&field, Mutation::Copy));
       }
+    } else if (field.is_proto3_simple ||
+               reflection->HasField(message, field.descriptor)) {
+      if (!field.is_message) callback(Candidate(&field, Mutation::Mutate));
+      if (!field.is_proto3_simple && (!field.is_required || !keep_initialized))
+        callback(Candidate(&field, Mutation::Delete));
+      callback(Candidate(&field, Mutation::Copy));
+    } else {
+      callback(Candidate(&field, Mutation::Add));
     }
   }
+}
 
-  bool keep_initialized_ = false;
+MutationScheduler::Operator GetSchedulerOperator(Mutation mutation) {
+  switch (mutation) {
+    case Mutation::Add:
+      return MutationScheduler::kAdd;
+    case Mutation::Mutate:
+      return MutationScheduler::kMutate;
+    case Mutation::Delete:
+      return MutationScheduler::kDelete;
+    case Mutation::Copy:
+      return MutationScheduler::kCopy;
+    default:
+      assert(false && "unexpected mutation");
+      return MutationScheduler::kMutate;
+  }
+}
 
-  RandomEngine* random_;
+// Returns weight of the candidate, scaled by the factor learned by
+// |scheduler| if any.
+uint64_t GetCandidateWeight(const Candidate& candidate,
+                            const MutationScheduler* scheduler) {
+  if (!scheduler) return kDefaultMutateWeight;
+  return kDefaultMutateWeight / MutationScheduler::kScale *
+         scheduler->GetFactor(GetSchedulerOperator(candidate.mutation),
+                              candidate.field->cpp_type);
+}
 
-  struct Result {
-    Result() = default;
-    Result(const FieldInstance& f, Mutation m) : field(f), mutation(m) {}
+// Binds candidate to particular field of oneof group or element of repeated
+// field.
+FieldInstance ResolveCandidate(const Candidate& candidate, Message* message,
+                               RandomEngine* random) {
+  const Reflection* reflection = message->GetReflection();
+  const FieldDescriptor* field = candidate.field->descriptor;
+  const OneofDescriptor* oneof = candidate.field->oneof;
+  if (oneof && candidate.mutation == Mutation::Add) {
+    const FieldDescriptor* current_field =
+        reflection->GetOneofFieldDescriptor(*message, oneof);
+    // Any field of the group, except the current one.
+    int index = GetRandomIndex(random, oneof->field_count() - !!current_field);
+    if (current_field && index >= current_field->index_in_oneof()) ++index;
+    return {message, oneof->field(index)};
+  }
+  if (!candidate.field->is_repeated) return {message, *candidate.field};
+  size_t field_size = reflection->FieldSize(*message, field);
+  if (candidate.mutation == Mutation::Add) ++field_size;
+  return {message, *candidate.field, GetRandomIndex(random, field_size)};
+}
 
-    FieldInstance field;
-    Mutation mutation = Mutation::None;
-  };
-  WeightedReservoirSampler<Result, RandomEngine> sampler_;
+// Populated field which can provide values for Copy mutation.
+struct CopySource {
+  Message* message;
+  const FieldInfo* field;
+  // Number of values, 1 for singular fields.
+  int size;
 };
 
-// Selects random field of compatible type to use for clone mutations.
-class DataSourceSampler {
- public:
-  DataSourceSampler(const ConstFieldInstance& match, RandomEngine* random,
-                    Message* message)
-      : match_(match), random_(random), sampler_(random) {
-    Sample(message);
+// Calls callback for every populated field of the message and nested
+// messages.
+template <class Callback>
+void ForEachCopySource(Message* message, Callback callback) {
+  const MessageInfo& info = MessageInfo::Get(message->GetDescriptor());
+  const Reflection* reflection = message->GetReflection();
+  // Copy candidates are offered exactly for populated fields.
+  ForEachCandidate(*message, false, [&](const Candidate& candidate) {
+    if (candidate.mutation != Mutation::Copy) return;
+    const FieldInfo* field = candidate.field;
+    callback(CopySource{
+        message, field,
+        field->is_repeated ? reflection->FieldSize(*message, field->descriptor)
+                           : 1});
+  });
+
+  for (int i : info.message_fields()) {
+    const FieldDescriptor* field = info.fields()[i].descriptor;
+    if (field->is_repeated()) {
+      const int field_size = reflection->FieldSize(*message, field);
+      for (int j = 0; j < field_size; ++j)
+        ForEachCopySource(reflection->MutableRepeatedMessage(message, field, j),
+                          callback);
+    } else if (reflection->HasField(*message, field)) {
+      ForEachCopySource(reflection->MutableMessage(message, field), callback);
+    }
   }
+}
 
-  // Returns selected field.
-  const ConstFieldInstance& field() const {
-    assert(!IsEmpty());
-    return sampler_.selected();
+// Selects random value from |sources| to copy into |destination|. All sources
+// must have the same value type as |destination|. Returns false if there is no
+// value different from the destination.
+bool SelectCopySource(const ConstFieldInstance& destination,
+                      const std::vector<CopySource>& sources,
+                      RandomEngine* random, ConstFieldInstance* selected) {
+  bool match_utf8 = destination.EnforceUtf8();
+  MessageFingerprints fingerprints;
+  WeightedReservoirSkipSampler<ConstFieldInstance, RandomEngine> sampler(
+      random);
+  for (const CopySource& source : sources) {
+    if (match_utf8 && !source.field->enforce_utf8) continue;
+    ConstFieldInstance value =
+        source.field->is_repeated
+            ? ConstFieldInstance(source.message, *source.field,
+                                 GetRandomIndex(random, source.size))
+            : ConstFieldInstance(source.message, *source.field);
+    if (!IsEqualValueField()(destination, value, &fingerprints))
+      sampler.Try(source.size, value);
   }
+  if (sampler.IsEmpty()) return false;
+  *selected = sampler.selected();
+  return true;
+}
+
+// Copy sources of the entire message by value type. Indexed selection doesn't
+// visit the message, so they are collected once, on the first selected Copy.
+class CopySources {
+ public:
+  struct Values {
+    std::vector<CopySource> sources;
+    // Total number of values of the sources.
+    uint64_t size = 0;
+  };
 
-  bool IsEmpty() const { return sampler_.IsEmpty(); }
+  explicit CopySources(Message* root) : root_(root) {}
+
+  const Values& Get(int value_type_id) {
+    if (!collected_) {
+      collected_ = true;
+      ForEachCopySource(root_, [this](const CopySource& source) {
+        int id = source.field->value_type_id;
+        if (id >= static_cast<int>(values_.size())) values_.resize(id + 1);
+        values_[id].sources.push_back(source);
+        values_[id].size += source.size;
+      });
+    }
+    if (value_type_id >= static_cast<int>(values_.size())) return empty_;
+    return values_[value_type_id];
+  }
 
  private:
-  void Sample(Message* message) {
-    const Descriptor* descriptor = message->GetDescriptor();
-    const Reflection* reflection = message->GetReflection();
+  Message* root_;
+  bool collected_ = false;
+  // Indexed by FieldInfo::value_type_id.
+  std::vector<Values> values_;
+  Values empty_;
+};
 
-    int field_count = descriptor->field_count();
-    for (int i = 0; i < field_count; ++i) {
-      const FieldDescriptor* field = descriptor->field(i);
-      if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
-        if (field->is_repeated()) {
-          const int field_size = reflection->FieldSize(*message, field);
-          for (int j = 0; j < field_size; ++j) {
-            Sample(reflection->MutableRepeatedMessage(message, field, j));
-          }
-        } else if (reflection->HasField(*message, field)) {
-          Sample(reflection->MutableMessage(message, field));
-        }
-      }
+// Returns true if |message| at nesting |depth| does not need InitializeAndTrim,
+// not including nested messages.
+bool IsCleanMessage(const Message& message, int depth, bool keep_initialized) {
+  if (depth >= kMaxInitializeDepth) return false;
+  if (!keep_initialized) return true;
+  const MessageInfo& info = MessageInfo::Get(message.GetDescriptor());
+  const Reflection* reflection = message.GetReflection();
+  for (int i : info.required_fields()) {
+    if (!reflection->HasField(message, info.fields()[i].descriptor))
+      return false;
+  }
+  return true;
+}
+
+// Returns true if |candidate| is still offered for the |message|.
+bool HasCandidate(const Message& message, bool keep_initialized,
+                  const Candidate& candidate) {
+  bool found = false;
+  ForEachCandidate(message, keep_initialized, [&](const Candidate& other) {
+    if (other.field == candidate.field && other.mutation == candidate.mutation)
+      found = true;
+  });
+  return found;
+}
 
-      if (field->cpp_type() != match_.cpp_type()) continue;
-      if (match_.cpp_type() == FieldDescriptor::CPPTYPE_ENUM) {
-        if (field->enum_type() != match_.enum_type()) continue;
-      } else if (match_.cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
-        if (field->message_type() != match_.message_type()) continue;
+// Selects random field and mutation from the given proto message.
+class MutationSampler {
+ public:
+  // Visits entire message once. Copy destinations and sources are collected
+  // per value type during the same traversal, and Copy is selected only if the
+  // destination type has another value to copy from. Only non-Copy candidates
+  // are sampled if |allow_copy| is false.
+  MutationSampler(bool keep_initialized, const MutationScheduler* scheduler,
+                  RandomEngine* random, Message* message, bool allow_copy)
+      : keep_initialized_(keep_initialized),
+        scheduler_(scheduler),
+        random_(random),
+        sampler_(random) {
+    Sample(message, 0);
+
+    if (allow_copy) {
+      // Sample between non-Copy candidates and Copy destinations of each value
+      // type, proportionally to their weights.
+      WeightedReservoirSkipSampler<int, RandomEngine> group(random);
+      group.Try(sampler_weight_, -1);
+      for (size_t i = 0; i < buckets_.size(); ++i) {
+        // Destination itself is one of the sources.
+        if (buckets_[i].source_size > 1)
+          group.Try(buckets_[i].destination_weight, i);
       }
+      if (group.IsEmpty()) return;
 
-      if (field->is_repeated()) {
-        if (int field_size = reflection->FieldSize(*message, field)) {
-          ConstFieldInstance source(message, field,
-                                    GetRandomIndex(random_, field_size));
-          if (match_.EnforceUtf8() && !source.EnforceUtf8()) continue;
-          if (!IsEqualValueField()(match_, source))
-            sampler_.Try(field_size, source);
-        }
-      } else {
-        if (reflection->HasField(*message, field)) {
-          ConstFieldInstance source(message, field);
-          if (match_.EnforceUtf8() && !source.EnforceUtf8()) continue;
-          if (!IsEqualValueField()(match_, source)) sampler_.Try(1, source);
-        }
+      if (group.selected() >= 0) {
+        const Bucket& bucket = buckets_[group.selected()];
+        Select(bucket.destinations.selected(), random);
+        if (SelectCopySource(field_, bucket.sources, random, &source_)) return;
       }
     }
+    // All sources match the destination. Fallback to non-Copy mutations.
+    Select(sampler_.selected(), random);
   }
 
-  ConstFieldInstance match_;
-  RandomEngine* random_;
+  // Selects candidate at |selection.offset| among own candidates of the
+  // |selection.message|, as returned by MutationIndex. Rejects the candidate
+  // with Mutation::None if the traversal above would not select it: Copy of
+  // a value type without other values, or any Copy if |allow_copy| is false.
+  // Then the caller selects again, so accepted candidates have the same
+  // distribution as with the traversal. Candidate is also rejected if weights
+  // of |scheduler| changed since the index was created.
+  MutationSampler(bool keep_initialized, const MutationScheduler* scheduler,
+                  RandomEngine* random,
+                  const MutationIndex::Selection& selection, bool allow_copy,
+                  CopySources* sources)
+      : keep_initialized_(keep_initialized),
+        scheduler_(scheduler),
+        random_(random),
+        sampler_(random),
+        is_clean_(false) {
+    Result result;
+    uint64_t offset = selection.offset;
+    ForEachCandidate(*selection.message, keep_initialized_,
+                     [&](const Candidate& candidate) {
+                       if (result.message) return;
+                       uint64_t weight =
+                           GetCandidateWeight(candidate, scheduler_);
+                       if (offset < weight)
+                         result = {selection.message, selection.depth,
+                                   candidate};
+                       else
+                         offset -= weight;
+                     });
+    if (result.candidate.mutation != Mutation::Copy) {
+      Select(result, random);
+      return;
+    }
+    if (!allow_copy) return;
+
+    const CopySources::Values& values =
+        sources->Get(result.candidate.field->value_type_id);
+    // Destination itself is one of the sources.
+    if (values.size <= 1) return;
+    Select(result, random);
+    if (!SelectCopySource(field_, values.sources, random, &source_)) {
+      mutation_ = Mutation::None;
+      copy_failed_ = true;
+    }
+  }
 
-  WeightedReservoirSampler<ConstFieldInstance, RandomEngine> sampler_;
-};
+  // Returns selected field.
+  const FieldInstance& field() const { return field_; }
 
-}  // namespace
+  // Returns selected mutation.
+  Mutation mutation() const { return mutation_; }
 
-class FieldMutator {
- public:
-  FieldMutator(size_t size_increase_hint, bool enforce_changes,
-               bool enforce_utf8_strings, Mutator* mutator)
-      : size_increase_hint_(size_increase_hint),
-        enforce_changes_(enforce_changes),
-        enforce_utf8_strings_(enforce_utf8_strings),
-        mutator_(mutator) {}
+  // Returns message which contains the selected field.
+  Message* message() const { return result_.message; }
 
-  void Mutate(int32_t* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateInt32, mutator_, _1));
-  }
+  // Returns nesting depth of message(), 0 for the root.
+  int depth() const { return result_.depth; }
 
-  void Mutate(int64_t* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateInt64, mutator_, _1));
-  }
+  // Returns true if the traversal found that the message does not need
+  // InitializeAndTrim. Indexed selection does not visit the message and
+  // always returns false.
+  bool is_clean() const { return is_clean_; }
 
-  void Mutate(uint32_t* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateUInt32, mutator_, _1));
-  }
+  // Returns true if indexed selection of Copy found no value different from
+  // the destination. The traversal falls back to non-Copy mutations then.
+  bool copy_failed() const { return copy_failed_; }
 
-  void Mutate(uint64_t* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateUInt64, mutator_, _1));
+  // Returns value to copy for Mutation::Copy.
+  const ConstFieldInstance& source() const {
+    assert(mutation_ == Mutation::Copy);
+    return source_;
   }
 
-  void Mutate(float* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateFloat, mutator_, _1));
+ private:
+  struct Result {
+    Result() = default;
+    Result(Message* m, int d, const Candidate& c)
+        : message(m), depth(d), candidate(c) {}
+
+    Message* message = nullptr;
+    int depth = 0;
+    Candidate candidate;
+  };
+
+  // Copy destinations and sources of the same value type.
+  struct Bucket {
+    explicit Bucket(RandomEngine* random) : destinations(random) {}
+
+    WeightedReservoirSkipSampler<Result, RandomEngine> destinations;
+    uint64_t destination_weight = 0;
+    std::vector<CopySource> sources;
+    uint64_t source_size = 0;
+  };
+
+  void Sample(Message* message, int depth) {
+    const MessageInfo& info = MessageInfo::Get(message->GetDescriptor());
+    const Reflection* reflection = message->GetReflection();
+    if (!IsCleanMessage(*message, depth, keep_initialized_)) is_clean_ = false;
+
+    ForEachCandidate(
+        *message, keep_initialized_, [&](const Candidate& candidate) {
+          uint64_t weight = GetCandidateWeight(candidate, scheduler_);
+          if (candidate.mutation != Mutation::Copy) {
+            sampler_.Try(weight, {message, depth, candidate});
+            sampler_weight_ += weight;
+            return;
+          }
+          // Copy candidates are offered exactly for populated fields, so the
+          // same field is also a source.
+          const FieldInfo* field = candidate.field;
+          Bucket& bucket = GetBucket(field->value_type_id);
+          bucket.destinations.Try(weight, {message, depth, candidate});
+          bucket.destination_weight += weight;
+          int size = field->is_repeated
+                         ? reflection->FieldSize(*message, field->descriptor)
+                         : 1;
+          bucket.sources.push_back({message, field, size});
+          bucket.source_size += size;
+        });
+
+    for (int i : info.message_fields()) {
+      const FieldDescriptor* field = info.fields()[i].descriptor;
+      if (field->is_repeated()) {
+        const int field_size = reflection->FieldSize(*message, field);
+        for (int j = 0; j < field_size; ++j)
+          Sample(reflection->MutableRepeatedMessage(message, field, j),
+                 depth + 1);
+      } else if (reflection->HasField(*message, field)) {
+        Sample(reflection->MutableMessage(message, field), depth + 1);
+      }
+    }
   }
 
-  void Mutate(double* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateDouble, mutator_, _1));
+  Bucket& GetBucket(int value_type_id) {
+    if (value_type_id >= static_cast<int>(bucket_slots_.size()))
+      bucket_slots_.resize(value_type_id + 1, -1);
+    int& slot = bucket_slots_[value_type_id];
+    if (slot < 0) {
+      slot = buckets_.size();
+      buckets_.emplace_back(random_);
+    }
+    return buckets_[slot];
   }
 
-  void Mutate(bool* value) const {
-    RepeatMutate(value, std::bind(&Mutator::MutateBool, mutator_, _1), 2);
+  void Select(const Result& result, RandomEngine* random) {
+    result_ = result;
+    mutation_ = result.candidate.mutation;
+    if (mutation_ != Mutation::None)
+      field_ = ResolveCandidate(result.candidate, result.message, random);
   }
 
-  void Mutate(FieldInstance::Enum* value) const {
-    RepeatMutate(&value->index,
-                 std::bind(&Mutator::MutateEnum, mutator_, _1, value->count),
-                 std::max<size_t>(value->count, 1));
-    assert(value->index < value->count);
+  bool keep_initialized_ = false;
+  const MutationScheduler* scheduler_;
+  RandomEngine* random_;
+
+  WeightedReservoirSkipSampler<Result, RandomEngine> sampler_;
+  uint64_t sampler_weight_ = 0;
+  // Indices into buckets_ by FieldInfo::value_type_id, -1 if none.
+  std::vector<int> bucket_slots_;
+  std::vector<Bucket> buckets_;
+  Result result_;
+  FieldInstance field_;
+  ConstFieldInstance source_;
+  Mutation mutation_ = Mutation::None;
+  bool is_clean_ = true;
+  bool copy_failed_ = false;
+};
+
+// Selects up to |count| distinct mutations from the given proto message in a
+// single traversal. Keeps visited messages, so mutations can be applied one
+// by one while skipping ones invalidated by earlier mutations.
+class MutationStackSampler {
+ public:
+  struct Result {
+    // Index of the message node.
+    size_t node;
+    Candidate candidate;
+  };
+
+  MutationStackSampler(bool keep_initialized,
+                       const MutationScheduler* scheduler, RandomEngine* random,
+                       Message* message, size_t count)
+      : keep_initialized_(keep_initialized),
+        scheduler_(scheduler),
+        sampler_(count, random) {
+    Sample(message, kNoParent, nullptr, 0);
   }
 
-  void Mutate(std::string* value) const {
-    if (enforce_utf8_strings_) {
-      RepeatMutate(value, std::bind(&Mutator::MutateUtf8String, mutator_, _1,
-                                    size_increase_hint_));
-    } else {
-      RepeatMutate(value, std::bind(&Mutator::MutateString, mutator_, _1,
-                                    size_increase_hint_));
+  // Returns selected mutations in the order to apply.
+  std::vector<Result> selected() const { return sampler_.selected(); }
+
+  Message* message(size_t node) const { return nodes_[node].message; }
+
+  int depth(size_t node) const { return nodes_[node].depth; }
+
+  // Returns true if the traversal found that the message does not need
+  // InitializeAndTrim.
+  bool is_clean() const { return is_clean_; }
+
+  // Marks nested messages of |field| of the |node|, or of entire oneof group
+  // of the |field|, as removed together with their nested messages.
+  void RemoveField(size_t node, const FieldDescriptor* field) {
+    const OneofDescriptor* oneof = field->containing_oneof();
+    // Nested nodes always follow the parent.
+    for (size_t i = node + 1; i < nodes_.size(); ++i) {
+      if (nodes_[i].parent != node) continue;
+      if (nodes_[i].field == field ||
+          (oneof && nodes_[i].field->containing_oneof() == oneof)) {
+        nodes_[i].removed = true;
+      }
     }
   }
 
-  void Mutate(std::unique_ptr<Message>* message) const {
-    assert(!enforce_changes_);
-    assert(*message);
-    if (GetRandomBool(mutator_->random(), 100)) return;
-    mutator_->Mutate(message->get(), size_increase_hint_);
+  // Returns true if the node or any of its parents was removed.
+  bool IsRemoved(size_t node) const {
+    for (; node != kNoParent; node = nodes_[node].parent) {
+      if (nodes_[node].removed) return true;
+    }
+    return false;
   }
 
  private:
-  template <class T, class F>
-  void RepeatMutate(T* value, F mutate,
-                    size_t unchanged_one_out_of = 100) const {
-    if (!enforce_changes_ &&
-        GetRandomBool(mutator_->random(), unchanged_one_out_of)) {
-      return;
-    }
-    T tmp = *value;
-    for (int i = 0; i < 10; ++i) {
-      *value = mutate(*value);
-      if (!enforce_changes_ || *value != tmp) return;
+  static const size_t kNoParent = -1;
+
+  struct Node {
+    Message* message;
+    size_t parent;
+    // Field of the parent which contains the message.
+    const FieldDescriptor* field;
+    int depth;
+    bool removed;
+  };
+
+  void Sample(Message* message, size_t parent, const FieldDescriptor* field,
+              int depth) {
+    size_t node = nodes_.size();
+    nodes_.push_back({message, parent, field, depth, false});
+    if (!IsCleanMessage(*message, depth, keep_initialized_)) is_clean_ = false;
+
+    ForEachCandidate(*message, keep_initialized_,
+                     [&](const Candidate& candidate) {
+                       sampler_.Try(GetCandidateWeight(candidate, scheduler_),
+                                    {node, candidate});
+                     });
+
+    const MessageInfo& info = MessageInfo::Get(message->GetDescriptor());
+    const Reflection* reflection = message->GetReflection();
+    for (int i : info.message_fields()) {
+      const FieldDescriptor* nested = info.fields()[i].descriptor;
+      if (nested->is_repeated()) {
+        const int field_size = reflection->FieldSize(*message, nested);
+        for (int j = 0; j < field_size; ++j)
+          Sample(reflection->MutableRepeatedMessage(message, nested, j), node,
+                 nested, depth + 1);
+      } else if (reflection->HasField(*message, nested)) {
+        Sample(reflection->MutableMessage(message, nested), node, nested,
+               depth + 1);
+      }
     }
   }
 
-  size_t size_increase_hint_;
-  size_t enforce_changes_;
-  bool enforce_utf8_strings_;
-  Mutator* mutator_;
+  bool keep_initialized_ = false;
+  const MutationScheduler* scheduler_;
+
+  WeightedReservoirMultiSampler<Result, RandomEngine> sampler_;
+  std::vector<Node> nodes_;
+  bool is_clean_ = true;
 };
 
-namespace {
+// Returns random size of a block in [1, max_size]. Every range between
+// powers of two is equally likely, so small blocks are common, but blocks as
+// large as the value still occur.
+size_t GetRandomBlockSize(size_t max_size, RandomEngine* random) {
+  assert(max_size);
+  size_t bits = 0;
+  while (max_size >> (bits + 1)) ++bits;
+  size_t limit =
+      std::min(max_size, size_t{1} << GetRandomIndex(random, bits + 2));
+  return 1 + GetRandomIndex(random, limit);
+}
 
-struct MutateField : public FieldFunction<MutateField> {
-  template <class T>
-  void ForType(const FieldInstance& field, size_t size_increase_hint,
-               Mutator* mutator) const {
-    T value;
-    field.Load(&value);
-    FieldMutator(size_increase_hint, true, field.EnforceUtf8(), mutator)
-        .Mutate(&value);
-    field.Store(value);
+void FillRandomBytes(char* bytes, size_t size, RandomEngine* random) {
+  for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t bits = GetRandomBits(random);
+    for (size_t j = i; j < std::min(size, i + sizeof(bits)); ++j, bits >>= 8)
+      bytes[j] = static_cast<char>(bits);
   }
-};
+}
 
-struct CreateField : public FieldFunction<CreateField> {
- public:
-  template <class T>
-  void ForType(const FieldInstance& field, size_t size_increase_hint,
-               Mutator* mutator) const {
-    T value;
-    field.GetDefault(&value);
-    FieldMutator field_mutator(size_increase_hint,
-                               false /* defaults could be useful */,
-                               field.EnforceUtf8(), mutator);
-    field_mutator.Mutate(&value);
-    field.Create(value);
+// Block mutations of DefaultMutationPolicy::MutateString. Each builds
+// |result| from |value| with a single allocation. They return false if the
+// mutation is not applicable to |value|.
+bool DeleteBlock(const std::string& value, RandomEngine* random,
+                 std::string* result) {
+  if (value.empty()) return false;
+  size_t size = GetRandomBlockSize(value.size(), random);
+  size_t pos = GetRandomIndex(random, value.size() - size + 1);
+  result->reserve(value.size() - size);
+  result->append(value, 0, pos);
+  result->append(value, pos + size, std::string::npos);
+  return true;
+}
+
+bool InsertBlock(const std::string& value, size_t size_increase_hint,
+                 RandomEngine* random, std::string* result) {
+  if (!size_increase_hint) return false;
+  size_t size = GetRandomBlockSize(size_increase_hint, random);
+  size_t pos = GetRandomIndex(random, value.size() + 1);
+  result->reserve(value.size() + size);
+  result->append(value, 0, pos);
+  result->resize(pos + size);
+  FillRandomBytes(&(*result)[pos], size, random);
+  result->append(value, pos, std::string::npos);
+  return true;
+}
+
+bool DuplicateBlock(const std::string& value, size_t size_increase_hint,
+                    RandomEngine* random, std::string* result) {
+  if (value.empty() || !size_increase_hint) return false;
+  size_t size = GetRandomBlockSize(std::min(value.size(), size_increase_hint),
+                                   random);
+  size_t from = GetRandomIndex(random, value.size() - size + 1);
+  size_t to = GetRandomIndex(random, value.size() + 1);
+  result->reserve(value.size() + size);
+  result->append(value, 0, to);
+  result->append(value, from, size);
+  result->append(value, to, std::string::npos);
+  return true;
+}
+
+// Overwrites a block with random bytes or with another block of the value.
+bool OverwriteBlock(const std::string& value, RandomEngine* random,
+                    std::string* result) {
+  if (value.empty()) return false;
+  size_t size = GetRandomBlockSize(value.size(), random);
+  size_t to = GetRandomIndex(random, value.size() - size + 1);
+  *result = value;
+  if (GetRandomBool(random)) {
+    FillRandomBytes(&(*result)[to], size, random);
+  } else {
+    size_t from = GetRandomIndex(random, value.size() - size + 1);
+    std::copy_n(value.begin() + from, size, result->begin() + to);
   }
-};
+  return true;
+}
+
+// Applies |mutation| to |field|. Add and Mutate call |mutate_value| with the
+// field and true for Add.
+template <class MutateValue>
+void ApplyMutation(Mutation mutation, const FieldInstance& field,
+                   const ConstFieldInstance& source, MutateValue mutate_value) {
+  switch (mutation) {
+    case Mutation::None:
+      break;
+    case Mutation::Add:
+      mutate_value(field, true);
+      break;
+    case Mutation::Mutate:
+      mutate_value(field, false);
+      break;
+    case Mutation::Delete:
+      DeleteField()(field);
+      break;
+    case Mutation::Copy:
+      CopyField()(source, field);
+      break;
+    default:
+      assert(false && "unexpected mutation");
+  }
+}
 
 }  // namespace
 
 Mutator::Mutator(RandomEngine* random) : random_(random) {}
 
 void Mutator::Mutate(Message* message, size_t size_increase_hint) {
-  bool repeat;
-  do {
-    repeat = false;
-    MutationSampler mutation(keep_initialized_, random_, message);
-    switch (mutation.mutation()) {
-      case Mutation::None:
-        break;
-      case Mutation::Add:
-        CreateField()(mutation.field(), size_increase_hint / 2, this);
-        break;
-      case Mutation::Mutate:
-        MutateField()(mutation.field(), size_increase_hint / 2, this);
-        break;
-      case Mutation::Delete:
-        DeleteField()(mutation.field());
-        break;
-      case Mutation::Copy: {
-        DataSourceSampler source(mutation.field(), random_, message);
-        if (source.IsEmpty()) {
-          repeat = true;
-          break;
-        }
-        CopyField()(source.field(), mutation.field());
-        break;
-      }
-      default:
-        assert(false && "unexpected mutation");
+  if (mutation_stack_depth_ > 1)
+    MutateStack(message, size_increase_hint);
+  else
+    MutateImpl(message, size_increase_hint, nullptr, nullptr);
+}
+
+void Mutator::Mutate(Message* message, size_t size_increase_hint,
+                     const MutationIndex& index) {
+  MutateImpl(message, size_increase_hint, &index, nullptr);
+}
+
+void Mutator::Mutate(Message* message, size_t size_increase_hint,
+                     MutationIndex* index) {
+  MutateImpl(message, size_increase_hint, index, index);
+}
+
+std::unique_ptr<MutationIndex> Mutator::CreateIndex(
+    const Message& message) const {
+  bool keep_initialized = keep_initialized_;
+  const MutationScheduler* scheduler = scheduler_;
+  return std::unique_ptr<MutationIndex>(new MutationIndex(
+      message, [keep_initialized, scheduler](const Message& node) {
+        uint64_t weight = 0;
+        ForEachCandidate(node, keep_initialized,
+                         [&weight, scheduler](const Candidate& candidate) {
+                           weight += GetCandidateWeight(candidate, scheduler);
+                         });
+        return weight;
+      }));
+}
+
+void Mutator::MutateBatch(const Message& message, size_t size_increase_hint,
+                          size_t count, const MutantCallback& callback) {
+  if (!count) return;
+  std::unique_ptr<MutationIndex> index = CreateIndex(message);
+  ConstFieldInstance::MessagePtr mutant(message.New(message.GetArena()));
+  for (size_t i = 0; i < count; ++i) {
+    mutant->CopyFrom(message);
+    Mutate(mutant.get(), size_increase_hint, *index);
+    callback(i, *mutant);
+  }
+}
+
+void Mutator::MutateImpl(Message* message, size_t size_increase_hint,
+                         const MutationIndex* index,
+                         MutationIndex* updated_index) {
+  auto mutate_value = [this, size_increase_hint](const FieldInstance& field,
+                                                 bool create) {
+    MutateFieldValue(field, create, size_increase_hint / 2);
+  };
+  auto apply = [&](const MutationSampler& mutation, bool is_clean) {
+    ApplyMutation(mutation.mutation(), mutation.field(),
+                  mutation.mutation() == Mutation::Copy ? mutation.source()
+                                                        : ConstFieldInstance(),
+                  mutate_value);
+    if (scheduler_ && mutation.mutation() != Mutation::None) {
+      scheduler_->OnMutation(GetSchedulerOperator(mutation.mutation()),
+                             mutation.field().cpp_type());
     }
-  } while (repeat);
 
-  InitializeAndTrim(message, kMaxInitializeDepth);
+    if (!is_clean) {
+      InitializeAndTrim(message, kMaxInitializeDepth);
+    } else if (mutation.mutation() != Mutation::None) {
+      InitializeAndTrimField(
+          mutation.message(), mutation.depth(),
+          mutation.mutation() == Mutation::Add ||
+                  mutation.mutation() == Mutation::Copy
+              ? mutation.field().MutableMessage()
+              : nullptr);
+    }
+  };
+
+  // Rejected indexed selections are cheap to repeat, but fallback to full
+  // traversal if the message has nothing else to offer.
+  CopySources sources(message);
+  bool allow_copy = true;
+  for (int attempt = 0; index && attempt < kMaxIndexAttempts; ++attempt) {
+    MutationIndex::Selection selection = index->Select(message, random_);
+    if (!selection.message) break;
+    MutationSampler mutation(keep_initialized_, scheduler_, random_, selection,
+                             allow_copy, &sources);
+    // As the traversal, fallback to non-Copy mutations.
+    if (mutation.copy_failed()) allow_copy = false;
+    if (mutation.mutation() == Mutation::None) continue;
+
+    bool is_clean = (index->is_initialized() || !keep_initialized_) &&
+                    index->max_depth() < kMaxInitializeDepth;
+    apply(mutation, is_clean);
+    if (updated_index && is_clean) {
+      const FieldInstance& field = mutation.field();
+      int size_change = 0;
+      if (mutation.mutation() == Mutation::Add) size_change = 1;
+      if (mutation.mutation() == Mutation::Delete) size_change = -1;
+      updated_index->Update(
+          selection, field.descriptor(),
+          field.descriptor()->is_repeated() ? static_cast<int>(field.index())
+                                            : -1,
+          size_change);
+    } else if (updated_index) {
+      updated_index->Reset(*message);
+    }
+    assert(!keep_initialized_ || message->IsInitialized());
+    return;
+  }
+
+  MutationSampler mutation(keep_initialized_, scheduler_, random_, message,
+                           allow_copy);
+  apply(mutation, mutation.is_clean());
+  if (updated_index) updated_index->Reset(*message);
+  assert(!keep_initialized_ || message->IsInitialized());
+}
+
+void Mutator::MutateStack(Message* message, size_t size_increase_hint) {
+  auto mutate_value = [this, size_increase_hint](const FieldInstance& field,
+                                                 bool create) {
+    MutateFieldValue(field, create, size_increase_hint / 2);
+  };
+  MutationStackSampler stack(keep_initialized_, scheduler_, random_, message,
+                             mutation_stack_depth_);
+  bool applied = false;
+  for (const MutationStackSampler::Result& result : stack.selected()) {
+    if (stack.IsRemoved(result.node)) continue;
+    Message* node = stack.message(result.node);
+    const Candidate& candidate = result.candidate;
+    // Earlier mutations may have changed the field.
+    if (applied && !HasCandidate(*node, keep_initialized_, candidate))
+      continue;
+
+    FieldInstance field = ResolveCandidate(candidate, node, random_);
+    ConstFieldInstance source;
+    if (candidate.mutation == Mutation::Copy) {
+      // Sources of the traversal may be modified by earlier mutations.
+      std::vector<CopySource> sources;
+      ForEachCopySource(message, [&](const CopySource& copy_source) {
+        if (copy_source.field->value_type_id == candidate.field->value_type_id)
+          sources.push_back(copy_source);
+      });
+      if (!SelectCopySource(field, sources, random_, &source)) continue;
+    }
+
+    if (candidate.field->is_message || candidate.field->oneof)
+      stack.RemoveField(result.node, candidate.field->descriptor);
+    ApplyMutation(candidate.mutation, field, source, mutate_value);
+    applied = true;
+    if (scheduler_) {
+      scheduler_->OnMutation(GetSchedulerOperator(candidate.mutation),
+                             field.cpp_type());
+    }
+
+    if (stack.is_clean()) {
+      InitializeAndTrimField(node, stack.depth(result.node),
+                             candidate.mutation == Mutation::Add ||
+                                     candidate.mutation == Mutation::Copy
+                                 ? field.MutableMessage()
+                                 : nullptr);
+    }
+  }
+
+  if (!applied)
+    return MutateImpl(message, size_increase_hint, nullptr, nullptr);
+  if (!stack.is_clean()) InitializeAndTrim(message, kMaxInitializeDepth);
   assert(!keep_initialized_ || message->IsInitialized());
 }
 
 void Mutator::CrossOver(const protobuf::Message& message1,
                         protobuf::Message* message2) {
-  // CrossOver can produce result which still equals to inputs. So we backup
-  // message2 to later comparison. message1 is already constant.
-  std::unique_ptr<protobuf::Message> message2_copy(message2->New());
-  message2_copy->CopyFrom(*message2);
-
   CrossOverImpl(message1, message2);
 
   InitializeAndTrim(message2, kMaxInitializeDepth);
   assert(!keep_initialized_ || message2->IsInitialized());
 
-  // Can't call mutate from crossover because of a bug in libFuzzer.
-  return;
-  // if (MessageDifferencer::Equals(*message2_copy, *message2) ||
-  //     MessageDifferencer::Equals(message1, *message2)) {
-  //   Mutate(message2, 0);
-  // }
+  // CrossOver can produce result which still equals to inputs, but we can't
+  // call mutate from crossover because of a bug in libFuzzer.
 }
 
 void Mutator::CrossOverImpl(const protobuf::Message& message1,
@@ -516,42 +1003,7 @@ void Mutator::CrossOverImpl(const protobuf::Message& message1,
     const FieldDescriptor* field = descriptor->field(i);
 
     if (field->is_repeated()) {
-      const int field_size1 = reflection->FieldSize(message1, field);
-      int field_size2 = reflection->FieldSize(*message2, field);
-      for (int j = 0; j < field_size1; ++j) {
-        ConstFieldInstance source(&message1, field, j);
-        FieldInstance destination(message2, field, field_size2++);
-        AppendField()(source, destination);
-      }
-
-      assert(field_size2 == reflection->FieldSize(*message2, field));
-
-      // Shuffle
-      for (int j = 0; j < field_size2; ++j) {
-        if (int k = GetRandomIndex(random_, field_size2 - j)) {
-          reflection->SwapElements(message2, field, j, j + k);
-        }
-      }
-
-      int keep = GetRandomIndex(random_, field_size2 + 1);
-
-      if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
-        int remove = field_size2 - keep;
-        // Cross some message to keep with messages to remove.
-        int cross = GetRandomIndex(random_, std::min(keep, remove) + 1);
-        for (int j = 0; j < cross; ++j) {
-          int k = GetRandomIndex(random_, keep);
-          int r = keep + GetRandomIndex(random_, remove);
-          assert(k != r);
-          CrossOverImpl(reflection->GetRepeatedMessage(*message2, field, r),
-                        reflection->MutableRepeatedMessage(message2, field, k));
-        }
-      }
-
-      for (int j = keep; j < field_size2; ++j)
-        reflection->RemoveLast(message2, field);
-      assert(keep == reflection->FieldSize(*message2, field));
-
+      CrossOverRepeatedField(message1, message2, field);
     } else if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
       if (!reflection->HasField(message1, field)) {
         if (GetRandomBool(random_))
@@ -578,94 +1030,214 @@ void Mutator::CrossOverImpl(const protobuf::Message& message1,
   }
 }
 
+void Mutator::CrossOverRepeatedField(const Message& message1,
+                                     Message* message2,
+                                     const FieldDescriptor* field) {
+  const Reflection* reflection = message2->GetReflection();
+  const int field_size1 = reflection->FieldSize(message1, field);
+  const int field_size2 = reflection->FieldSize(*message2, field);
+  const int total = field_size1 + field_size2;
+
+  // Result is a random subset of elements of both fields in random order.
+  // Elements are numbered with [0, field_size2) for message2, followed by
+  // message1. Only the first |keep| of |order| are shuffled and survive, so
+  // only the survivors of message1 are copied.
+  std::vector<int> order(total);
+  std::iota(order.begin(), order.end(), 0);
+  const int keep = GetRandomIndex(random_, total + 1);
+  for (int i = 0; i < keep; ++i)
+    std::swap(order[i], order[i + GetRandomIndex(random_, total - i)]);
+
+  // Append surviving elements of message1 and replace their numbers in
+  // |order| with positions in message2.
+  int field_size = field_size2;
+  for (int i = 0; i < keep; ++i) {
+    if (order[i] < field_size2) continue;
+    AppendField()(ConstFieldInstance(&message1, field, order[i] - field_size2),
+                  FieldInstance(message2, field, field_size));
+    order[i] = field_size++;
+  }
+  assert(field_size == reflection->FieldSize(*message2, field));
+
+  // Move survivors into [0, keep) in the selected order. |position| and
+  // |element| map element numbers to their current positions and back.
+  std::vector<int> position(field_size);
+  std::iota(position.begin(), position.end(), 0);
+  std::vector<int> element(position);
+  for (int i = 0; i < keep; ++i) {
+    int j = position[order[i]];
+    if (i == j) continue;
+    reflection->SwapElements(message2, field, i, j);
+    std::swap(element[i], element[j]);
+    position[element[i]] = i;
+    position[element[j]] = j;
+  }
+
+  if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+    int remove = total - keep;
+    // Cross some message to keep with messages to remove. Removed messages of
+    // message2 are still at positions past |keep|.
+    int cross = GetRandomIndex(random_, std::min(keep, remove) + 1);
+    for (int j = 0; j < cross; ++j) {
+      int k = GetRandomIndex(random_, keep);
+      int r = order[keep + GetRandomIndex(random_, remove)];
+      const Message& source =
+          r < field_size2
+              ? reflection->GetRepeatedMessage(*message2, field, position[r])
+              : reflection->GetRepeatedMessage(message1, field,
+                                               r - field_size2);
+      assert(r >= field_size2 || position[r] >= keep);
+      CrossOverImpl(source,
+                    reflection->MutableRepeatedMessage(message2, field, k));
+    }
+  }
+
+  for (int j = keep; j < field_size; ++j)
+    reflection->RemoveLast(message2, field);
+  assert(keep == reflection->FieldSize(*message2, field));
+}
+
+void Mutator::InitializeAndTrimField(Message* message, int depth,
+                                     Message* value) {
+  // Only the mutated field may need fixing. Add and Copy of a message field
+  // bring a new subtree, other mutations can't break a clean message.
+  int max_depth = kMaxInitializeDepth - depth;
+  if (max_depth <= 0)
+    InitializeAndTrim(message, max_depth);
+  else if (value)
+    InitializeAndTrim(value, max_depth - 1);
+}
+
 void Mutator::InitializeAndTrim(Message* message, int max_depth) {
-  const Descriptor* descriptor = message->GetDescriptor();
+  const MessageInfo& info = MessageInfo::Get(message->GetDescriptor());
+  // Skip types which can't have missing required fields and which are not
+  // deep enough to be trimmed.
+  if ((!keep_initialized_ || !info.requires_initialization()) &&
+      info.max_nesting_depth() <= max_depth) {
+    return;
+  }
   const Reflection* reflection = message->GetReflection();
-  for (int i = 0; i < descriptor->field_count(); ++i) {
-    const FieldDescriptor* field = descriptor->field(i);
-    if (keep_initialized_ && field->is_required() &&
-        !reflection->HasField(*message, field))
-      CreateDefaultField()(FieldInstance(message, field));
-
-    if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
-      if (max_depth <= 0 && !field->is_required()) {
-        // Clear deep optional fields to avoid stack overflow.
-        reflection->ClearField(message, field);
-        if (field->is_repeated())
-          assert(!reflection->FieldSize(*message, field));
-        else
-          assert(!reflection->HasField(*message, field));
-        continue;
-      }
+  if (keep_initialized_) {
+    for (int i : info.required_fields()) {
+      const FieldDescriptor* field = info.fields()[i].descriptor;
+      if (!reflection->HasField(*message, field))
+        CreateDefaultField()(FieldInstance(message, field));
+    }
+  }
 
-      if (field->is_repeated()) {
-        const int field_size = reflection->FieldSize(*message, field);
-        for (int j = 0; j < field_size; ++j) {
-          Message* nested_message =
-              reflection->MutableRepeatedMessage(message, field, j);
-          InitializeAndTrim(nested_message, max_depth - 1);
-        }
-      } else if (reflection->HasField(*message, field)) {
-        Message* nested_message = reflection->MutableMessage(message, field);
+  for (int i : info.message_fields()) {
+    const FieldInfo& field_info = info.fields()[i];
+    const FieldDescriptor* field = field_info.descriptor;
+    if (max_depth <= 0 && !field_info.is_required) {
+      // Clear deep optional fields to avoid stack overflow.
+      reflection->ClearField(message, field);
+      if (field_info.is_repeated)
+        assert(!reflection->FieldSize(*message, field));
+      else
+        assert(!reflection->HasField(*message, field));
+      continue;
+    }
+
+    if (field_info.is_repeated) {
+      const int field_size = reflection->FieldSize(*message, field);
+      for (int j = 0; j < field_size; ++j) {
+        Message* nested_message =
+            reflection->MutableRepeatedMessage(message, field, j);
         InitializeAndTrim(nested_message, max_depth - 1);
       }
+    } else if (reflection->HasField(*message, field)) {
+      Message* nested_message = reflection->MutableMessage(message, field);
+      InitializeAndTrim(nested_message, max_depth - 1);
     }
   }
 }
 
-int32_t Mutator::MutateInt32(int32_t value) { return FlipBit(value, random_); }
+void Mutator::MutateFieldValue(const FieldInstance& field, bool create,
+                               size_t size_increase_hint) {
+  MutateOrCreateField(field, create, size_increase_hint, this);
+}
+
+int32_t Mutator::MutateInt32(int32_t value) {
+  return DefaultMutationPolicy::MutateInt32(value, random_);
+}
 
-int64_t Mutator::MutateInt64(int64_t value) { return FlipBit(value, random_); }
+int64_t Mutator::MutateInt64(int64_t value) {
+  return DefaultMutationPolicy::MutateInt64(value, random_);
+}
 
 uint32_t Mutator::MutateUInt32(uint32_t value) {
-  return FlipBit(value, random_);
+  return DefaultMutationPolicy::MutateUInt32(value, random_);
 }
 
 uint64_t Mutator::MutateUInt64(uint64_t value) {
-  return FlipBit(value, random_);
+  return DefaultMutationPolicy::MutateUInt64(value, random_);
 }
 
-float Mutator::MutateFloat(float value) { return FlipBit(value, random_); }
+float Mutator::MutateFloat(float value) {
+  return DefaultMutationPolicy::MutateFloat(value, random_);
+}
 
-double Mutator::MutateDouble(double value) { return FlipBit(value, random_); }
+double Mutator::MutateDouble(double value) {
+  return DefaultMutationPolicy::MutateDouble(value, random_);
+}
 
-bool Mutator::MutateBool(bool value) { return !value; }
+bool Mutator::MutateBool(bool value) {
+  return DefaultMutationPolicy::MutateBool(value, random_);
+}
 
 size_t Mutator::MutateEnum(size_t index, size_t item_count) {
-  if (item_count <= 1) return 0;
-  return (index + 1 + GetRandomIndex(random_, item_count - 1)) % item_count;
+  return DefaultMutationPolicy::MutateEnum(index, item_count, random_);
 }
 
 std::string Mutator::MutateString(const std::string& value,
                                   size_t size_increase_hint) {
-  std::string result = value;
-
-  while (!result.empty() && GetRandomBool(random_)) {
-    result.erase(GetRandomIndex(random_, result.size()), 1);
-  }
+  return DefaultMutationPolicy::MutateString(value, size_increase_hint,
+                                             random_);
+}
 
-  while (result.size() < size_increase_hint && GetRandomBool(random_)) {
-    size_t index = GetRandomIndex(random_, result.size() + 1);
-    result.insert(result.begin() + index, GetRandomIndex(random_, 1 << 8));
+std::string DefaultMutationPolicy::MutateString(const std::string& value,
+                                                size_t size_increase_hint,
+                                                RandomEngine* random) {
+  std::string result;
+  bool mutated = false;
+  switch (GetRandomIndex(random, 4)) {
+    case 0:
+      mutated = DeleteBlock(value, random, &result);
+      break;
+    case 1:
+      mutated = InsertBlock(value, size_increase_hint, random, &result);
+      break;
+    case 2:
+      mutated = DuplicateBlock(value, size_increase_hint, random, &result);
+      break;
+    case 3:
+      mutated = OverwriteBlock(value, random, &result);
+      break;
   }
+  if (mutated && result != value) return result;
 
-  if (result != value) return result;
-
-  if (result.empty()) {
-    result.push_back(GetRandomIndex(random_, 1 << 8));
-    return result;
-  }
+  if (value.empty()) return std::string(1, GetRandomIndex(random, 1 << 8));
 
-  if (!result.empty())
-    FlipBit(result.size(), reinterpret_cast<uint8_t*>(&result[0]), random_);
+  result = value;
+  FlipBit(result.size(), reinterpret_cast<uint8_t*>(&result[0]), random);
   return result;
 }
 
-std::string Mutator::MutateUtf8String(const std::string& value,
-                                      size_t size_increase_hint) {
-  std::string str = MutateString(value, size_increase_hint);
-  FixUtf8String(&str, random_);
-  return str;
+std::string SpliceString(const std::string& value, const std::string& source,
+                         size_t size_increase_hint, RandomEngine* random) {
+  bool insert = size_increase_hint && (value.empty() || GetRandomBool(random));
+  if (source.empty() || (!insert && value.empty())) return value;
+  size_t size = GetRandomBlockSize(
+      std::min(source.size(), insert ? size_increase_hint : value.size()),
+      random);
+  size_t from = GetRandomIndex(random, source.size() - size + 1);
+  size_t to = GetRandomIndex(random, value.size() + 1 - (insert ? 0 : size));
+  std::string result;
+  result.reserve(value.size() + (insert ? size : 0));
+  result.append(value, 0, to);
+  result.append(source, from, size);
+  result.append(value, insert ? to : to + size, std::string::npos);
+  return result;
 }
 
 }  // namespace protobuf_mutator
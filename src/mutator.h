@@ -19,6 +19,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <cassert>
+#include <functional>
 #include <memory>
 #include <random>
 #include <string>
@@ -28,6 +30,10 @@
 
 namespace protobuf_mutator {
 
+class FieldInstance;
+class MutationIndex;
+class MutationScheduler;
+
 // Randomly makes incremental change in the given protobuf.
 // Usage example:
 //    protobuf_mutator::Mutator mutator(1);
@@ -36,10 +42,11 @@ namespace protobuf_mutator {
 //    mutator.Mutate(&message, 10000);
 //
 // Class implements very basic mutations of fields. E.g. it just flips bits for
-// integers, floats and strings. Also it increases, decreases size of
-// strings only by one. For better results users should override
+// integers and floats, and inserts, deletes or overwrites random blocks of
+// strings. For better results users should override
 // protobuf_mutator::Mutator::Mutate* methods with more useful logic, e.g. using
-// library like libFuzzer.
+// library like libFuzzer. BasicMutator does the same with a policy class
+// resolved at compile time.
 class Mutator {
  public:
   // seed: value to initialize random number generator.
@@ -54,9 +61,61 @@ class Mutator {
   // requested.
   void Mutate(protobuf::Message* message, size_t size_increase_hint);
 
+  // Same as above, but selects the field to mutate in O(depth) using |index|
+  // instead of visiting every field of the message. |index| must be created by
+  // CreateIndex for |message| or for a message equal to it, e.g. when the same
+  // input is mutated many times. Copy still visits the message to find values
+  // to copy. Mutations are sampled with the same probabilities as above, if
+  // the scheduler didn't change since CreateIndex.
+  void Mutate(protobuf::Message* message, size_t size_increase_hint,
+              const MutationIndex& index);
+
+  // Same as above, and updates |index| for the mutated |message|, e.g. when
+  // the output of the mutation is mutated again. Update costs O(depth *
+  // fanout) and the size of the new nested message, if any.
+  void Mutate(protobuf::Message* message, size_t size_increase_hint,
+              MutationIndex* index);
+
+  // Creates index of mutations of the message for the methods above. Takes as
+  // long as Mutate without the index. The scheduler, if any, must outlive the
+  // index.
+  std::unique_ptr<MutationIndex> CreateIndex(
+      const protobuf::Message& message) const;
+
+  // Called by MutateBatch for every mutant. |mutant| is valid only during the
+  // call.
+  using MutantCallback =
+      std::function<void(size_t index, const protobuf::Message& mutant)>;
+
+  // Produces |count| independent mutants of |message|. Each mutant is a copy of
+  // |message| with a single mutation. Message is indexed once for all mutants.
+  void MutateBatch(const protobuf::Message& message, size_t size_increase_hint,
+                   size_t count, const MutantCallback& callback);
+
   void CrossOver(const protobuf::Message& message1,
                  protobuf::Message* message2);
 
+  // Number of mutations which Mutate applies to the message per call. They
+  // are selected with a single traversal of the message. Mutations with
+  // MutationIndex are not stacked. Default is 1.
+  void set_mutation_stack_depth(size_t depth) {
+    mutation_stack_depth_ = depth;
+  }
+
+  // Strings longer than |size| bytes are mutated in a random window of |size|
+  // bytes, so attempts to mutate them don't copy the whole value. The window
+  // is copied into a scratch buffer reused by the mutator. Default is 64 KiB.
+  void set_string_window_size(size_t size) {
+    assert(size);
+    string_window_size_ = size;
+    std::string().swap(string_scratch_);
+  }
+
+  // Scales weights of mutations by factors learned by |scheduler| and reports
+  // applied mutations to it. MutationIndex keeps weights of messages from the
+  // time they were indexed. nullptr, the default, disables scheduling.
+  void set_scheduler(MutationScheduler* scheduler) { scheduler_ = scheduler; }
+
  protected:
   // TODO(vitalybuka): Consider to replace with single mutate (uint8_t*, size).
   virtual int32_t MutateInt32(int32_t value);
@@ -77,15 +136,39 @@ class Mutator {
   RandomEngine* random() { return random_; }
 
  private:
+  template <class M>
   friend class FieldMutator;
+  template <class M>
+  friend struct MutateField;
   friend class TestMutator;
+
+  // Mutates value of |field|, or creates the field with a random value if
+  // |create| is set. Calls Mutate* methods above. BasicMutator overrides it to
+  // call them without virtual dispatch.
+  virtual void MutateFieldValue(const FieldInstance& field, bool create,
+                                size_t size_increase_hint);
+
+  // Selects with |index|, if any, and updates |updated_index|, which is
+  // either nullptr or |index|.
+  void MutateImpl(protobuf::Message* message, size_t size_increase_hint,
+                  const MutationIndex* index, MutationIndex* updated_index);
+  void MutateStack(protobuf::Message* message, size_t size_increase_hint);
   void InitializeAndTrim(protobuf::Message* message, int max_depth);
+  // Fixes a clean message after mutation of a field of |message| at nesting
+  // |depth|. |value| is the new value of the field, if it's a message.
+  void InitializeAndTrimField(protobuf::Message* message, int depth,
+                              protobuf::Message* value);
   void CrossOverImpl(const protobuf::Message& message1,
                      protobuf::Message* message2);
-  std::string MutateUtf8String(const std::string& value,
-                               size_t size_increase_hint);
+  void CrossOverRepeatedField(const protobuf::Message& message1,
+                              protobuf::Message* message2,
+                              const protobuf::FieldDescriptor* field);
 
   bool keep_initialized_ = true;
+  size_t mutation_stack_depth_ = 1;
+  MutationScheduler* scheduler_ = nullptr;
+  size_t string_window_size_ = 1 << 16;
+  std::string string_scratch_;
   RandomEngine* random_;
 };
 
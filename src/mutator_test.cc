@@ -16,6 +16,8 @@
 #include "src/mutator.h"
 
 #include <algorithm>
+#include <chrono>
+#include <map>
 #include <set>
 #include <string>
 #include <tuple>
@@ -23,7 +25,10 @@
 #include <vector>
 
 #include "port/gtest.h"
+#include "src/basic_mutator.h"
 #include "src/binary_format.h"
+#include "src/field_mutator.h"
+#include "src/mutation_index.h"
 #include "src/mutator_test_proto2.pb.h"
 #include "src/mutator_test_proto3.pb.h"
 #include "src/text_format.h"
@@ -525,6 +530,30 @@ TYPED_TEST(MutatorTypedTest, CrossOverRepeated) {
   EXPECT_EQ(1u << 6, sets.size());
 }
 
+TYPED_TEST(MutatorTypedTest, CrossOverRepeatedOrder) {
+  typename TestFixture::Message m1;
+  m1.add_repeated_int32(1);
+  m1.add_repeated_int32(2);
+
+  typename TestFixture::Message m2;
+  m2.add_repeated_int32(3);
+  m2.add_repeated_int32(4);
+
+  int iterations = 10000;
+  std::set<std::vector<int>> sequences;
+  TestMutator mutator(false);
+  for (int j = 0; j < iterations; ++j) {
+    typename TestFixture::Message message;
+    message.CopyFrom(m1);
+    mutator.NoDeDupCrossOver(m2, &message);
+    sequences.insert(
+        {message.repeated_int32().begin(), message.repeated_int32().end()});
+  }
+
+  // Every ordered selection of the 4 elements.
+  EXPECT_EQ(1u + 4 + 4 * 3 + 4 * 3 * 2 + 4 * 3 * 2 * 1, sequences.size());
+}
+
 TYPED_TEST(MutatorTypedTest, CrossOverRepeatedMessages) {
   typename TestFixture::Message m1;
   auto* rm1 = m1.add_repeated_msg();
@@ -578,6 +607,269 @@ TYPED_TEST(MutatorTypedTest, FailedMutations) {
   EXPECT_LT(crossovers, 100u);
 }
 
+TYPED_TEST(MutatorTypedTest, IndexedMutations) {
+  TestMutator mutator(false);
+  for (int i = 0; i < 1000; ++i) {
+    typename TestFixture::Message message;
+    for (int j = 0; j < 20; ++j) mutator.Mutate(&message, 1000);
+
+    std::unique_ptr<MutationIndex> index = mutator.CreateIndex(message);
+    for (int j = 0; j < 10; ++j) {
+      typename TestFixture::Message tmp;
+      tmp.CopyFrom(message);
+      mutator.Mutate(&tmp, 1000, *index);
+      // Mutate must not produce the same result.
+      EXPECT_FALSE(MessageDifferencer::Equals(message, tmp));
+    }
+  }
+}
+
+TYPED_TEST(MutatorTypedTest, UpdatedIndex) {
+  for (bool keep_initialized : {false, true}) {
+    TestMutator mutator(keep_initialized);
+    typename TestFixture::Message message;
+    std::unique_ptr<MutationIndex> index = mutator.CreateIndex(message);
+    for (int i = 0; i < 300; ++i) {
+      mutator.Mutate(&message, 1000, index.get());
+      EXPECT_TRUE(!keep_initialized || message.IsInitialized());
+
+      // Updated index must select the same as a new one.
+      std::unique_ptr<MutationIndex> expected = mutator.CreateIndex(message);
+      ASSERT_EQ(expected->total_weight(), index->total_weight());
+      ASSERT_EQ(expected->max_depth(), index->max_depth());
+      ASSERT_EQ(expected->is_initialized(), index->is_initialized());
+      RandomEngine random1(i);
+      RandomEngine random2(i);
+      for (int j = 0; j < 10; ++j) {
+        MutationIndex::Selection a = expected->Select(&message, &random1);
+        MutationIndex::Selection b = index->Select(&message, &random2);
+        ASSERT_EQ(a.message, b.message);
+        ASSERT_EQ(a.offset, b.offset);
+      }
+    }
+  }
+}
+
+TYPED_TEST(MutatorTypedTest, StackedMutations) {
+  for (bool keep_initialized : {false, true}) {
+    TestMutator mutator(keep_initialized);
+    mutator.set_mutation_stack_depth(5);
+    size_t unchanged = 0;
+    for (int i = 0; i < 1000; ++i) {
+      typename TestFixture::Message message;
+      for (int j = 0; j < 20; ++j) {
+        typename TestFixture::Message tmp;
+        tmp.CopyFrom(message);
+        mutator.Mutate(&message, 1000);
+        EXPECT_TRUE(!keep_initialized || message.IsInitialized());
+        // Later mutations rarely revert earlier ones, e.g. Add and Delete of
+        // the same element.
+        if (MessageDifferencer::Equals(message, tmp)) ++unchanged;
+      }
+    }
+    EXPECT_LT(unchanged, 200u);
+  }
+}
+
+TYPED_TEST(MutatorTypedTest, MutateBatch) {
+  TestMutator mutator(false);
+  for (int i = 0; i < 100; ++i) {
+    typename TestFixture::Message message;
+    for (int j = 0; j < 20; ++j) mutator.Mutate(&message, 1000);
+    typename TestFixture::Message copy;
+    copy.CopyFrom(message);
+
+    size_t mutants = 0;
+    mutator.MutateBatch(message, 1000, 10,
+                        [&](size_t index, const protobuf::Message& mutant) {
+                          EXPECT_EQ(mutants++, index);
+                          EXPECT_FALSE(
+                              MessageDifferencer::Equals(message, mutant));
+                        });
+    EXPECT_EQ(10u, mutants);
+    EXPECT_TRUE(MessageDifferencer::Equals(message, copy));
+  }
+}
+
+TYPED_TEST(MutatorTypedTest, ArenaMutations) {
+  TestMutator mutator(false);
+  protobuf::Arena arena;
+  for (int i = 0; i < 1000; ++i) {
+    using Message = typename TestFixture::Message;
+    Message* message = protobuf::Arena::CreateMessage<Message>(&arena);
+    Message* other = protobuf::Arena::CreateMessage<Message>(&arena);
+    for (int j = 0; j < 20; ++j) {
+      Message tmp;
+      tmp.CopyFrom(*message);
+      mutator.Mutate(message, 1000);
+      // Mutate must not produce the same result.
+      EXPECT_FALSE(MessageDifferencer::Equals(*message, tmp));
+      mutator.Mutate(other, 1000);
+    }
+    mutator.CrossOver(*other, message);
+  }
+}
+
+TYPED_TEST(MutatorTypedTest, StringWindow) {
+  const size_t kWindow = 64;
+  TestMutator mutator(false);
+  mutator.set_string_window_size(kWindow);
+  std::string original;
+  for (int i = 0; i < 1 << 12; ++i) original.push_back('a' + i % 26);
+
+  size_t changed = 0;
+  for (int i = 0; i < 1000; ++i) {
+    typename TestFixture::Message message;
+    message.set_optional_string(original);
+    message.add_repeated_bytes(original);
+    mutator.Mutate(&message, 1000);
+    std::vector<std::string> values(message.repeated_bytes().begin(),
+                                    message.repeated_bytes().end());
+    values.push_back(message.optional_string());
+    for (const std::string& value : values) {
+      // Skip deleted and new values.
+      if (value.size() + kWindow < original.size() || value == original)
+        continue;
+      ++changed;
+      // Only a single window may differ, and for UTF-8 strings the code point
+      // before it.
+      size_t size = std::min(value.size(), original.size());
+      size_t prefix = std::mismatch(value.begin(), value.begin() + size,
+                                    original.begin())
+                          .first -
+                      value.begin();
+      size_t suffix = std::mismatch(value.rbegin(), value.rbegin() + size,
+                                    original.rbegin())
+                          .first -
+                      value.rbegin();
+      EXPECT_GE(prefix + suffix + 3, original.size() - kWindow);
+    }
+  }
+  EXPECT_GT(changed, 10u);
+
+  // The last window of a value may change too.
+  original.resize(kWindow + 1);
+  bool last_changed = false;
+  for (int i = 0; i < 10000 && !last_changed; ++i) {
+    typename TestFixture::Message message;
+    message.add_repeated_bytes(original);
+    mutator.Mutate(&message, 1000);
+    if (message.repeated_bytes_size() != 1) continue;
+    const std::string& value = message.repeated_bytes(0);
+    last_changed = !value.empty() && value.back() != original.back();
+  }
+  EXPECT_TRUE(last_changed);
+}
+
+std::string GetRandomString(size_t size, RandomEngine* random) {
+  std::string value;
+  for (size_t i = 0; i < size; ++i)
+    value.push_back(GetRandomIndex(random, 1 << 8));
+  return value;
+}
+
+TEST(MutateStringTest, SizeIncreaseHint) {
+  RandomEngine random(17);
+  for (size_t size : {0, 1, 2, 10, 1000}) {
+    for (size_t hint : {0, 1, 2, 10, 1000}) {
+      for (int i = 0; i < 1000; ++i) {
+        std::string value = GetRandomString(size, &random);
+        std::string result =
+            DefaultMutationPolicy::MutateString(value, hint, &random);
+        EXPECT_NE(value, result);
+        EXPECT_LE(result.size(), value.size() + std::max<size_t>(hint, !size));
+      }
+    }
+  }
+}
+
+TEST(MutateStringTest, BlockSizes) {
+  RandomEngine random(17);
+  std::string value = GetRandomString(1 << 16, &random);
+  std::set<size_t> sizes;
+  for (int i = 0; i < 10000; ++i) {
+    sizes.insert(
+        DefaultMutationPolicy::MutateString(value, 1 << 16, &random).size());
+  }
+  // Strings grow and shrink by blocks of different sizes, not by a byte.
+  EXPECT_LT(*sizes.begin(), value.size() - (1 << 10));
+  EXPECT_GT(*sizes.rbegin(), value.size() + (1 << 10));
+  EXPECT_GT(sizes.size(), 1000u);
+}
+
+TEST(MutateStringTest, SpliceString) {
+  RandomEngine random(17);
+  const std::string value = "0123456789";
+  const std::string source = "abcdefghij";
+  for (size_t hint : {0, 1, 10}) {
+    for (int i = 0; i < 1000; ++i) {
+      std::string result = SpliceString(value, source, hint, &random);
+      EXPECT_LE(result.size(), value.size() + hint);
+      size_t begin = result.find_first_not_of(value);
+      size_t end = result.find_last_not_of(value) + 1;
+      ASSERT_NE(std::string::npos, begin);
+      // A single block of |source| is inserted or replaces a block of |value|.
+      EXPECT_NE(std::string::npos,
+                source.find(result.substr(begin, end - begin)));
+      EXPECT_EQ(value.substr(0, begin), result.substr(0, begin));
+    }
+  }
+  EXPECT_EQ("", SpliceString("", source, 0, &random));
+  EXPECT_EQ(value, SpliceString(value, "", 10, &random));
+}
+
+// Not a benchmark, only reports time per mutation of values from 1 KB to 10 MB.
+// Time per byte must not grow with size of the value, compare reported
+// properties to check it.
+TEST(MutateStringTest, LargeValues) {
+  RandomEngine random(17);
+  const size_t kSizes[] = {1 << 10, 16 << 10, 256 << 10, 4 << 20, 10 << 20};
+  const int kMutations = 50;
+  for (size_t size : kSizes) {
+    std::string value = GetRandomString(size, &random);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kMutations; ++i) {
+      std::string result =
+          DefaultMutationPolicy::MutateString(value, size, &random);
+      EXPECT_LE(result.size(), 2 * size);
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    RecordProperty("us_per_mutation_of_" + std::to_string(size),
+                   std::to_string(elapsed.count() / kMutations));
+  }
+}
+
+// Counts calls to check that BasicMutator uses the policy.
+struct CountingPolicy : public DefaultMutationPolicy {
+  static int32_t MutateInt32(int32_t value, RandomEngine* random) {
+    ++calls;
+    return DefaultMutationPolicy::MutateInt32(value, random);
+  }
+
+  static size_t calls;
+};
+
+size_t CountingPolicy::calls = 0;
+
+TYPED_TEST(MutatorTypedTest, PolicyMutations) {
+  RandomEngine random(17);
+  BasicMutator<CountingPolicy> mutator(&random);
+  CountingPolicy::calls = 0;
+  for (int i = 0; i < 100; ++i) {
+    typename TestFixture::Message message;
+    for (int j = 0; j < 20; ++j) {
+      typename TestFixture::Message tmp;
+      tmp.CopyFrom(message);
+      mutator.Mutate(&message, 1000);
+      // Mutate must not produce the same result.
+      EXPECT_FALSE(MessageDifferencer::Equals(message, tmp));
+      EXPECT_TRUE(message.IsInitialized());
+    }
+  }
+  EXPECT_GT(CountingPolicy::calls, 0u);
+}
+
 TYPED_TEST(MutatorTypedTest, Serialization) {
   TestMutator mutator(false);
   for (int i = 0; i < 10000; ++i) {
@@ -632,6 +924,66 @@ TEST(MutatorMessagesTest, UsageExample) {
   EXPECT_EQ(3u * 5u, mutations.size());
 }
 
+TEST(MutatorMessagesTest, IndexedUsageExample) {
+  SmallMessage message;
+  TestMutator mutator(false);
+
+  std::set<std::string> mutations;
+  for (int j = 0; j < 1000; ++j) {
+    mutator.Mutate(&message, 1000, *mutator.CreateIndex(message));
+    std::string str = SaveMessageAsText(message);
+    mutations.insert(str);
+  }
+
+  EXPECT_EQ(3u * 5u, mutations.size());
+}
+
+// Returns names of fields of |message1| and |message2| with different values.
+std::string GetChangedFields(const protobuf::Message& message1,
+                             const protobuf::Message& message2) {
+  const protobuf::Descriptor* descriptor = message1.GetDescriptor();
+  std::string result;
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const protobuf::FieldDescriptor* field = descriptor->field(i);
+    MessageDifferencer differencer;
+    if (!differencer.CompareWithFields(message1, message2, {field}, {field}))
+      result += field->name() + " ";
+  }
+  return result;
+}
+
+// Indexed selection samples mutations with the same probabilities as the
+// traversal, including Copy which falls back to other mutations if all values
+// are equal.
+TEST(MutatorMessagesTest, IndexedDistribution) {
+  const int kRuns = 50000;
+  // Proto3 fields always offer Copy. Most copies fail, as the values are
+  // zeros, but bytes can be copied from the string.
+  Msg3 message;
+  message.set_optional_string("a");
+  message.set_optional_bytes("b");
+  ReducedTestMutator mutator;
+  std::unique_ptr<MutationIndex> index = mutator.CreateIndex(message);
+
+  std::map<std::string, int> traversal;
+  std::map<std::string, int> indexed;
+  for (int i = 0; i < kRuns; ++i) {
+    Msg3 mutant = message;
+    mutator.Mutate(&mutant, 1000);
+    ++traversal[GetChangedFields(message, mutant)];
+    mutant = message;
+    mutator.Mutate(&mutant, 1000, *index);
+    ++indexed[GetChangedFields(message, mutant)];
+  }
+
+  for (const auto& count : traversal) {
+    EXPECT_NEAR(count.second / static_cast<double>(kRuns),
+                indexed[count.first] / static_cast<double>(kRuns), 0.004)
+        << count.first;
+  }
+  EXPECT_EQ(traversal.size(), indexed.size());
+}
+
 TEST(MutatorMessagesTest, EmptyMessage) {
   EmptyMessage message;
   TestMutator mutator(false);
@@ -0,0 +1,283 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// protoc plugin which generates <name>.pb_mutator.cc with statically typed
+// accessors of scalar and string fields for every message of <name>.proto.
+// Linking the generated file into a fuzzer registers the accessors, and Mutator
+// uses them instead of reflection for messages of generated classes.
+//
+// Usage example:
+//    protoc --plugin=protoc-gen-mutator=path/to/protoc_plugin
+//        --mutator_out=out_dir --cpp_out=out_dir foo.proto
+
+#include <stdint.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/compiler/code_generator.h"
+#include "google/protobuf/compiler/plugin.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/printer.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+
+namespace protobuf_mutator {
+namespace {
+
+namespace protobuf = google::protobuf;
+
+using protobuf::Descriptor;
+using protobuf::FieldDescriptor;
+using protobuf::FieldOptions;
+using protobuf::FileDescriptor;
+using protobuf::FileOptions;
+using protobuf::compiler::CodeGenerator;
+using protobuf::compiler::GeneratorContext;
+using protobuf::io::Printer;
+
+// Names which protoc C++ generator suffixes with '_'.
+const std::set<std::string>& GetKeywords() {
+  static const std::set<std::string>* keywords = new std::set<std::string>{
+      "NULL", "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand",
+      "bitor", "bool", "break", "case", "catch", "char", "char8_t", "char16_t",
+      "char32_t", "class", "co_await", "co_return", "co_yield", "compl",
+      "concept", "const", "consteval", "constexpr", "constinit", "const_cast",
+      "continue", "decltype", "default", "delete", "do", "double",
+      "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false",
+      "float", "for", "friend", "goto", "if", "inline", "int", "long",
+      "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr",
+      "operator", "or", "or_eq", "private", "protected", "public", "register",
+      "reinterpret_cast", "requires", "return", "short", "signed", "sizeof",
+      "static", "static_assert", "static_cast", "struct", "switch", "template",
+      "this", "thread_local", "throw", "true", "try", "typedef", "typeid",
+      "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+      "wchar_t", "while", "xor", "xor_eq"};
+  return *keywords;
+}
+
+std::string ResolveKeyword(const std::string& name) {
+  return GetKeywords().count(name) ? name + "_" : name;
+}
+
+std::string StripProto(const std::string& filename) {
+  const std::string suffix = ".proto";
+  if (filename.size() >= suffix.size() &&
+      filename.compare(filename.size() - suffix.size(), suffix.size(),
+                       suffix) == 0) {
+    return filename.substr(0, filename.size() - suffix.size());
+  }
+  return filename;
+}
+
+std::string Replace(std::string text, const std::string& from,
+                    const std::string& to) {
+  for (size_t pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+  return text;
+}
+
+// Fully qualified name of the generated class.
+std::string ClassName(const Descriptor& message) {
+  const std::string& package = message.file()->package();
+  std::string name = message.full_name();
+  if (!package.empty()) name = name.substr(package.size() + 1);
+  std::string result = "::";
+  if (!package.empty()) result += Replace(package, ".", "::") + "::";
+  return result + ResolveKeyword(Replace(name, ".", "_"));
+}
+
+// Name of the generated accessors of the field.
+std::string FieldName(const FieldDescriptor& field) {
+  std::string name = field.name();
+  for (char& c : name) {
+    if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+  }
+  return ResolveKeyword(name);
+}
+
+// Returns C++ type which ConstFieldInstance uses for values of the field, or
+// nullptr if the field needs reflection.
+const char* GetValueType(const FieldDescriptor& field) {
+  if (field.options().weak()) return nullptr;
+  switch (field.cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return "int32_t";
+    case FieldDescriptor::CPPTYPE_INT64:
+      return "int64_t";
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return "uint32_t";
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return "uint64_t";
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return "double";
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return "float";
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return "bool";
+    case FieldDescriptor::CPPTYPE_STRING:
+      // Cord and StringPiece fields have different accessors.
+      if (field.options().ctype() != FieldOptions::STRING) return nullptr;
+      return "std::string";
+    case FieldDescriptor::CPPTYPE_ENUM:
+      // Mutator works with enum value indices, reflection maps them.
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      return nullptr;
+  }
+  return nullptr;
+}
+
+const char* GetCppTypeName(FieldDescriptor::CppType cpp_type) {
+  switch (cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return "CPPTYPE_INT32";
+    case FieldDescriptor::CPPTYPE_INT64:
+      return "CPPTYPE_INT64";
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return "CPPTYPE_UINT32";
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return "CPPTYPE_UINT64";
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return "CPPTYPE_DOUBLE";
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return "CPPTYPE_FLOAT";
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return "CPPTYPE_BOOL";
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return "CPPTYPE_ENUM";
+    case FieldDescriptor::CPPTYPE_STRING:
+      return "CPPTYPE_STRING";
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      return "CPPTYPE_MESSAGE";
+  }
+  return "";
+}
+
+class AccessorsGenerator {
+ public:
+  explicit AccessorsGenerator(Printer* printer) : printer_(printer) {}
+
+  void GenerateMessage(const Descriptor& message) {
+    for (int i = 0; i < message.nested_type_count(); ++i)
+      GenerateMessage(*message.nested_type(i));
+    // Map entries have no generated classes of their own.
+    if (message.options().map_entry()) return;
+
+    std::string class_name = ClassName(message);
+    std::vector<std::pair<const FieldDescriptor*, std::string>> fields;
+    for (int i = 0; i < message.field_count(); ++i) {
+      const FieldDescriptor& field = *message.field(i);
+      const char* type = GetValueType(field);
+      if (!type) continue;
+      std::string accessor = "kAccessor" + std::to_string(accessor_count_++);
+      GenerateField(class_name, field, type, accessor);
+      fields.emplace_back(&field, accessor);
+    }
+    if (fields.empty()) return;
+
+    std::string id = std::to_string(message_count_++);
+    printer_->Print(
+        "const ::protobuf_mutator::GeneratedFieldAccessors kFields$id$[] = {\n",
+        "id", id);
+    for (const auto& field : fields) {
+      printer_->Print(
+          "    {$number$, ::google::protobuf::FieldDescriptor::$cpp_type$, "
+          "&$accessor$},\n",
+          "number", std::to_string(field.first->number()), "cpp_type",
+          GetCppTypeName(field.first->cpp_type()), "accessor", field.second);
+    }
+    printer_->Print("};\n\n");
+    printer_->Print(
+        "const ::protobuf_mutator::GeneratedMessageAccessors kMessage$id$ = {\n"
+        "    \"$full_name$\", &$class$::GetReflection, kFields$id$, "
+        "$count$};\n"
+        "const ::protobuf_mutator::GeneratedAccessorsRegistration\n"
+        "    kRegistration$id$(&kMessage$id$);\n\n",
+        "id", id, "full_name", message.full_name(), "class", class_name,
+        "count", std::to_string(fields.size()));
+  }
+
+ private:
+  void GenerateField(const std::string& class_name,
+                     const FieldDescriptor& field, const char* type,
+                     const std::string& accessor) {
+    std::string name = FieldName(field);
+    bool repeated = field.is_repeated();
+    printer_->Print(
+        "const ::protobuf_mutator::GeneratedAccessor<$type$> $accessor$ = {\n"
+        "    []($const_message$ message, int$index$) -> $type$ {\n"
+        "      return static_cast<const $class$&>(message).$name$($get_arg$);\n"
+        "    },\n"
+        "    []($message$ message, int$index$, const $type$& value) {\n"
+        "      static_cast<$class$*>(message)->set_$name$($set_args$);\n"
+        "    }};\n\n",
+        "type", type, "accessor", accessor, "const_message",
+        "const ::google::protobuf::Message&", "message",
+        "::google::protobuf::Message*", "index", repeated ? " index" : "",
+        "class", class_name, "name", name, "get_arg", repeated ? "index" : "",
+        "set_args", repeated ? "index, value" : "value");
+  }
+
+  Printer* printer_;
+  int accessor_count_ = 0;
+  int message_count_ = 0;
+};
+
+class Generator : public CodeGenerator {
+ public:
+  bool Generate(const FileDescriptor* file, const std::string& parameter,
+                GeneratorContext* context, std::string* error) const override {
+    std::string base = StripProto(file->name());
+    std::unique_ptr<protobuf::io::ZeroCopyOutputStream> output(
+        context->Open(base + ".pb_mutator.cc"));
+    Printer printer(output.get(), '$');
+    printer.Print(
+        "// Generated by protoc-gen-mutator from $file$. DO NOT EDIT!\n\n",
+        "file", file->name());
+
+    // Lite messages have no reflection, and Mutator can't work with them.
+    if (file->options().optimize_for() == FileOptions::LITE_RUNTIME) {
+      printer.Print("// No accessors for LITE_RUNTIME messages.\n");
+      return true;
+    }
+
+    printer.Print(
+        "#include \"$base$.pb.h\"\n"
+        "#include \"src/generated_accessors.h\"\n\n"
+        "namespace {\n\n",
+        "base", base);
+    AccessorsGenerator generator(&printer);
+    for (int i = 0; i < file->message_type_count(); ++i)
+      generator.GenerateMessage(*file->message_type(i));
+    printer.Print("}  // namespace\n");
+    return true;
+  }
+
+  uint64_t GetSupportedFeatures() const override {
+    return FEATURE_PROTO3_OPTIONAL;
+  }
+};
+
+}  // namespace
+}  // namespace protobuf_mutator
+
+int main(int argc, char* argv[]) {
+  protobuf_mutator::Generator generator;
+  return google::protobuf::compiler::PluginMain(argc, argv, &generator);
+}
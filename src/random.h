@@ -16,11 +16,119 @@
 #ifndef SRC_RANDOM_H_
 #define SRC_RANDOM_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cassert>
+#include <limits>
 #include <random>
 
 namespace protobuf_mutator {
 
+// xoshiro256** generator, http://prng.di.unimi.it/. It has 32 bytes of state
+// which is seeded in O(1), unlike 2.5KB of std::mt19937, so it's cheap to
+// create one for every libFuzzer callback. Same seed produces the same
+// sequence on all platforms.
+class Xoshiro256StarStar {
+ public:
+  using result_type = uint64_t;
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  explicit Xoshiro256StarStar(uint64_t seed = 0) { this->seed(seed); }
+
+  // Expands |seed| into the state with splitmix64, as recommended by authors
+  // of the generator.
+  void seed(uint64_t seed) {
+    for (uint64_t& s : state_) {
+      seed += 0x9E3779B97F4A7C15ull;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      s = z ^ (z >> 31);
+    }
+  }
+
+  result_type operator()() {
+    const uint64_t result = Rotl(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = Rotl(state_[3], 45);
+    return result;
+  }
+
+ private:
+  static uint64_t Rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+  uint64_t state_[4];
+};
+
+// Define PROTOBUF_MUTATOR_USE_MT19937 to get sequences of older versions.
+#ifdef PROTOBUF_MUTATOR_USE_MT19937
 using RandomEngine = std::mt19937;
+#else
+using RandomEngine = Xoshiro256StarStar;
+#endif  // PROTOBUF_MUTATOR_USE_MT19937
+
+// Returns 64 random bits.
+inline uint64_t GetRandomBits(RandomEngine* random) {
+  static_assert(RandomEngine::min() == 0, "Unsupported RandomEngine");
+  static_assert(RandomEngine::max() == std::numeric_limits<uint64_t>::max() ||
+                    RandomEngine::max() == std::numeric_limits<uint32_t>::max(),
+                "Unsupported RandomEngine");
+  if (RandomEngine::max() == std::numeric_limits<uint64_t>::max())
+    return (*random)();
+  uint64_t high = (*random)();
+  return (high << 32) | (*random)();
+}
+
+// Return random integer from [0, count). Uses multiply-shift instead of
+// std::uniform_int_distribution, which needs rejection loop. The bias is at
+// most count / 2^64.
+inline uint64_t GetRandomUInt64(RandomEngine* random, uint64_t count) {
+  assert(count > 0);
+  return static_cast<uint64_t>(
+      (static_cast<unsigned __int128>(GetRandomBits(random)) * count) >> 64);
+}
+
+// Same for other engines, e.g. in tests.
+template <class Engine>
+uint64_t GetRandomUInt64(Engine* random, uint64_t count) {
+  assert(count > 0);
+  return std::uniform_int_distribution<uint64_t>(0, count - 1)(*random);
+}
+
+// Returns random double from (0, 1].
+inline double GetRandomUnit(RandomEngine* random) {
+  return ((GetRandomBits(random) >> 11) + 1) * (1.0 / (1ull << 53));
+}
+
+// Same for other engines, e.g. in tests.
+template <class Engine>
+double GetRandomUnit(Engine* random) {
+  // generate_canonical may return 1.0, which would map to 0.
+  double value = 1.0 - std::generate_canonical<double, 53>(*random);
+  return value > 0 ? value : 1.0;
+}
+
+// Return random integer from [0, count)
+inline size_t GetRandomIndex(RandomEngine* random, size_t count) {
+  assert(count > 0);
+  if (count == 1) return 0;
+  return GetRandomUInt64(random, count);
+}
+
+// Return true with probability about 1-of-n.
+inline bool GetRandomBool(RandomEngine* random, size_t n = 2) {
+  return GetRandomIndex(random, n) == 0;
+}
 
 }  // namespace protobuf_mutator
 
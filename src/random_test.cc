@@ -0,0 +1,77 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/random.h"
+
+#include <vector>
+
+#include "port/gtest.h"
+
+namespace protobuf_mutator {
+
+TEST(Xoshiro256StarStarTest, Sequence) {
+  // Must not change, fuzzers expect the same mutations for the same seed.
+  Xoshiro256StarStar random(0);
+  EXPECT_EQ(0x99ec5f36cb75f2b4ull, random());
+  EXPECT_EQ(0xbf6e1f784956452aull, random());
+  EXPECT_EQ(0x1a5f849d4933e6e0ull, random());
+}
+
+TEST(Xoshiro256StarStarTest, Seed) {
+  Xoshiro256StarStar random1(1);
+  Xoshiro256StarStar random2(2);
+  EXPECT_NE(random1(), random2());
+
+  random1.seed(2);
+  random2.seed(2);
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(random1(), random2());
+}
+
+TEST(RandomTest, GetRandomIndex) {
+  RandomEngine random(1);
+  for (size_t count : {1, 2, 3, 7, 100, 1000000}) {
+    for (int i = 0; i < 1000; ++i)
+      EXPECT_LT(GetRandomIndex(&random, count), count);
+  }
+  EXPECT_LT(GetRandomUInt64(&random, 1ull << 63), 1ull << 63);
+}
+
+TEST(RandomTest, Distribution) {
+  RandomEngine random(1);
+  const size_t kCount = 10;
+  const int kTries = 100000;
+  std::vector<int> histogram(kCount);
+  for (int i = 0; i < kTries; ++i)
+    ++histogram[GetRandomIndex(&random, kCount)];
+  for (int value : histogram) {
+    EXPECT_GT(value, kTries / kCount * 9 / 10);
+    EXPECT_LT(value, kTries / kCount * 11 / 10);
+  }
+
+  int hits = 0;
+  for (int i = 0; i < kTries; ++i) hits += GetRandomBool(&random, 100);
+  EXPECT_GT(hits, kTries / 100 * 8 / 10);
+  EXPECT_LT(hits, kTries / 100 * 12 / 10);
+}
+
+TEST(RandomTest, Determinism) {
+  RandomEngine random1(17);
+  RandomEngine random2(17);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(GetRandomIndex(&random1, i + 1),
+              GetRandomIndex(&random2, i + 1));
+  }
+}
+
+}  // namespace protobuf_mutator
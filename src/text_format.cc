@@ -14,41 +14,72 @@
 // limitations under the License.
 
 #include "src/text_format.h"
+
+#include <limits.h>
+
+#include <algorithm>
+
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "port/protobuf.h"
+#include "src/text_parser.h"
 
 namespace protobuf_mutator {
 
 using protobuf::Message;
 using protobuf::TextFormat;
 
-bool ParseTextMessage(const uint8_t* data, size_t size, Message* output) {
-  return ParseTextMessage({data, data + size}, output);
+namespace {
+
+// Prints messages on a single line without indentation, and repeated scalars
+// as lists, e.g. "a: [1, 2] b { c: 3 } ".
+void SetCompactMode(TextFormat::Printer* printer) {
+  printer->SetSingleLineMode(true);
+  printer->SetUseShortRepeatedPrimitives(true);
 }
 
-bool ParseTextMessage(const std::string& data, protobuf::Message* output) {
+}  // namespace
+
+bool ParseTextMessage(const uint8_t* data, size_t size, Message* output) {
+  // Parsers are reused, so their buffers and settings survive between inputs.
+  thread_local CompactTextParser compact_parser;
+  thread_local TextFormat::Parser parser;
+
   output->Clear();
-  TextFormat::Parser parser;
+  if (compact_parser.Parse(reinterpret_cast<const char*>(data), size, output))
+    return true;
+  output->Clear();
+  if (size > INT_MAX) return false;
+  protobuf::io::ArrayInputStream input(data, static_cast<int>(size));
   parser.AllowPartialMessage(true);
-  if (!parser.ParseFromString(data, output)) {
+  if (!parser.Parse(&input, output)) {
     output->Clear();
     return false;
   }
   return true;
 }
 
+bool ParseTextMessage(const std::string& data, protobuf::Message* output) {
+  return ParseTextMessage(reinterpret_cast<const uint8_t*>(data.data()),
+                          data.size(), output);
+}
+
 size_t SaveMessageAsText(const Message& message, uint8_t* data,
                          size_t max_size) {
-  std::string result = SaveMessageAsText(message);
-  if (result.size() <= max_size) {
-    memcpy(data, result.data(), result.size());
-    return result.size();
-  }
-  return 0;
+  // The stream fails when the buffer is full, and then the printer skips the
+  // rest of the output.
+  protobuf::io::ArrayOutputStream output(
+      data, static_cast<int>(std::min<size_t>(max_size, INT_MAX)));
+  TextFormat::Printer printer;
+  SetCompactMode(&printer);
+  if (!printer.Print(message, &output)) return 0;
+  return output.ByteCount();
 }
 
 std::string SaveMessageAsText(const protobuf::Message& message) {
   String tmp;
-  if (!protobuf::TextFormat::PrintToString(message, &tmp)) return {};
+  TextFormat::Printer printer;
+  SetCompactMode(&printer);
+  if (!printer.PrintToString(message, &tmp)) return {};
   return tmp;
 }
 
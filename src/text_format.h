@@ -22,10 +22,12 @@
 
 namespace protobuf_mutator {
 
-// Text serialization of protos.
+// Text serialization of protos. Messages are printed on a single line.
 bool ParseTextMessage(const uint8_t* data, size_t size,
                       protobuf::Message* output);
 bool ParseTextMessage(const std::string& data, protobuf::Message* output);
+// Prints directly into |data|. Returns 0 if the message is larger than
+// |max_size|, the content of |data| is unspecified then.
 size_t SaveMessageAsText(const protobuf::Message& message, uint8_t* data,
                          size_t max_size);
 std::string SaveMessageAsText(const protobuf::Message& message);
@@ -0,0 +1,66 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/text_format.h"
+
+#include <string>
+#include <vector>
+
+#include "port/gtest.h"
+#include "src/mutator.h"
+#include "src/mutator_test_proto2.pb.h"
+
+namespace protobuf_mutator {
+
+using protobuf::util::MessageDifferencer;
+
+TEST(TextFormatTest, SaveMessageAsText) {
+  Msg message;
+  message.add_repeated_int32(1);
+  message.add_repeated_int32(2);
+  message.mutable_optional_msg()->set_optional_string("a\nb");
+  std::string expected = SaveMessageAsText(message);
+  EXPECT_EQ(
+      "optional_msg { optional_string: \"a\\nb\" } repeated_int32: [1, 2] ",
+      expected);
+
+  std::vector<uint8_t> data(expected.size() + 1, 0xFF);
+  EXPECT_EQ(expected.size(),
+            SaveMessageAsText(message, data.data(), expected.size()));
+  EXPECT_EQ(expected, std::string(data.begin(), data.end() - 1));
+  EXPECT_EQ(0xFF, data.back());
+
+  EXPECT_EQ(0u, SaveMessageAsText(message, data.data(), expected.size() - 1));
+  EXPECT_EQ(0u, SaveMessageAsText(message, data.data(), 0));
+  EXPECT_EQ(0u, SaveMessageAsText(Msg(), data.data(), 0));
+}
+
+TEST(TextFormatTest, RoundTrip) {
+  RandomEngine random(17);
+  Mutator mutator(&random);
+  std::vector<uint8_t> data(1 << 16);
+  for (int i = 0; i < 1000; ++i) {
+    Msg message;
+    for (int j = 0; j < 10; ++j) mutator.Mutate(&message, 1000);
+    size_t size = SaveMessageAsText(message, data.data(), data.size());
+    ASSERT_GT(size, 0u);
+    EXPECT_EQ(SaveMessageAsText(message),
+              std::string(data.begin(), data.begin() + size));
+    Msg parsed;
+    EXPECT_TRUE(ParseTextMessage(data.data(), size, &parsed));
+    EXPECT_TRUE(MessageDifferencer::Equals(message, parsed));
+  }
+}
+
+}  // namespace protobuf_mutator
@@ -0,0 +1,364 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/text_parser.h"
+
+#include <stdlib.h>
+
+#include <limits>
+#include <type_traits>
+
+#include "src/field_instance.h"
+#include "src/message_info.h"
+
+namespace protobuf_mutator {
+
+using protobuf::FieldDescriptor;
+using protobuf::Message;
+using protobuf::Reflection;
+
+namespace {
+
+// Deeper messages are left to TextFormat::Parser.
+const int kMaxDepth = 100;
+
+// Same as whitespace of protobuf::io::Tokenizer.
+bool IsWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+bool IsOctalDigit(char c) { return c >= '0' && c <= '7'; }
+
+bool IsLetter(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// Numbers must be separated from following tokens.
+bool IsValueEnd(const char* pos, const char* end) {
+  return pos == end || IsWhitespace(*pos) || *pos == '}' || *pos == ']' ||
+         *pos == ',';
+}
+
+// Characters which CEscape prints as is.
+bool IsPrintable(char c) {
+  return static_cast<unsigned char>(c) >= 0x20 &&
+         static_cast<unsigned char>(c) < 0x7f;
+}
+
+// Same as SafeDoubleToFloat of TextFormat::Parser.
+float ToFloat(double value) {
+  if (value > std::numeric_limits<float>::max())
+    return std::numeric_limits<float>::infinity();
+  if (value < -std::numeric_limits<float>::max())
+    return -std::numeric_limits<float>::infinity();
+  return static_cast<float>(value);
+}
+
+// Sets singular field or appends to repeated one.
+template <class T>
+void SetValue(Message* message, const FieldInfo& field, const T& value) {
+  if (!field.is_repeated) return FieldInstance(message, field).Store(value);
+  size_t field_size =
+      message->GetReflection()->FieldSize(*message, field.descriptor);
+  FieldInstance(message, field, field_size).Create(value);
+}
+
+}  // namespace
+
+bool CompactTextParser::Parse(const char* data, size_t size,
+                              Message* output) {
+  pos_ = data;
+  end_ = data + size;
+  return ParseMessage(output, 0);
+}
+
+bool CompactTextParser::ParseMessage(Message* message, int depth) {
+  const MessageInfo& info = MessageInfo::Get(message->GetDescriptor());
+  for (;;) {
+    SkipWhitespace();
+    if (pos_ == end_) return depth == 0;
+    if (*pos_ == '}') {
+      ++pos_;
+      return depth > 0;
+    }
+    if (!ParseField(message, info, depth)) return false;
+  }
+}
+
+bool CompactTextParser::ParseField(Message* message, const MessageInfo& info,
+                                   int depth) {
+  if (!ParseIdentifier(&name_)) return false;
+  const FieldInfo* field = info.FindFieldByTextName(name_);
+  if (!field) return false;
+  const Reflection* reflection = message->GetReflection();
+  // TextFormat::Parser rejects singular fields which are already set.
+  if (!field->is_repeated) {
+    if (reflection->HasField(*message, field->descriptor)) return false;
+    if (field->oneof && reflection->HasOneof(*message, field->oneof))
+      return false;
+  }
+
+  SkipWhitespace();
+  bool has_colon = Consume(':');
+  SkipWhitespace();
+  if (field->is_message) {
+    if (!Consume('{') || depth >= kMaxDepth) return false;
+    Message* nested =
+        field->is_repeated
+            ? reflection->AddMessage(message, field->descriptor)
+            : reflection->MutableMessage(message, field->descriptor);
+    return ParseMessage(nested, depth + 1);
+  }
+  if (!has_colon) return false;
+  if (field->is_repeated && Consume('[')) return ParseList(message, *field);
+  return ParseValue(message, *field);
+}
+
+bool CompactTextParser::ParseList(Message* message, const FieldInfo& field) {
+  SkipWhitespace();
+  if (Consume(']')) return true;
+  for (;;) {
+    SkipWhitespace();
+    if (!ParseValue(message, field)) return false;
+    SkipWhitespace();
+    if (Consume(']')) return true;
+    if (!Consume(',')) return false;
+  }
+}
+
+bool CompactTextParser::ParseValue(Message* message, const FieldInfo& field) {
+  switch (field.cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32: {
+      int32_t value;
+      if (!ParseInteger(&value)) return false;
+      SetValue(message, field, value);
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_INT64: {
+      int64_t value;
+      if (!ParseInteger(&value)) return false;
+      SetValue(message, field, value);
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_UINT32: {
+      uint32_t value;
+      if (!ParseInteger(&value)) return false;
+      SetValue(message, field, value);
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_UINT64: {
+      uint64_t value;
+      if (!ParseInteger(&value)) return false;
+      SetValue(message, field, value);
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      double value;
+      if (!ParseDouble(&value)) return false;
+      SetValue(message, field, value);
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      double value;
+      if (!ParseDouble(&value)) return false;
+      SetValue(message, field, ToFloat(value));
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_BOOL: {
+      bool value;
+      if (!ParseBool(&value)) return false;
+      SetValue(message, field, value);
+      return true;
+    }
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return ParseEnum(message, field);
+    case FieldDescriptor::CPPTYPE_STRING:
+      if (!ParseString(&value_)) return false;
+      SetValue(message, field, value_);
+      return true;
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      return false;
+  }
+  return false;
+}
+
+bool CompactTextParser::ParseEnum(Message* message, const FieldInfo& field) {
+  const protobuf::EnumDescriptor* type = field.descriptor->enum_type();
+  const protobuf::EnumValueDescriptor* value = nullptr;
+  if (ParseIdentifier(&value_)) {
+    value = type->FindValueByName(value_);
+  } else {
+    // Printed for unknown values of open enums, which are left to
+    // TextFormat::Parser.
+    int32_t number;
+    if (!ParseInteger(&number)) return false;
+    value = type->FindValueByNumber(number);
+  }
+  if (!value) return false;
+  SetValue(message, field,
+           ConstFieldInstance::Enum{static_cast<size_t>(value->index()),
+                                    static_cast<size_t>(type->value_count())});
+  return true;
+}
+
+bool CompactTextParser::ParseBool(bool* value) {
+  if (!ParseIdentifier(&value_)) return false;
+  if (value_ == "true") {
+    *value = true;
+    return true;
+  }
+  if (value_ == "false") {
+    *value = false;
+    return true;
+  }
+  return false;
+}
+
+bool CompactTextParser::ParseDouble(double* value) {
+  bool negative = Consume('-');
+  if (ParseIdentifier(&value_)) {
+    if (value_ == "inf") {
+      *value = std::numeric_limits<double>::infinity();
+    } else if (value_ == "nan") {
+      *value = std::numeric_limits<double>::quiet_NaN();
+    } else {
+      return false;
+    }
+    if (negative) *value = -*value;
+    return true;
+  }
+
+  const char* begin = pos_;
+  bool is_integer = true;
+  while (pos_ != end_) {
+    char c = *pos_;
+    if (c == '.' || c == 'e' || c == 'E') {
+      is_integer = false;
+    } else if (c == '+' || c == '-') {
+      if (pos_ == begin || (pos_[-1] != 'e' && pos_[-1] != 'E')) break;
+    } else if (!IsDigit(c)) {
+      break;
+    }
+    ++pos_;
+  }
+  if (pos_ == begin) return false;
+  // Leading zeros start octal numbers, and TextFormat::Parser reads long
+  // integers with its own rounding.
+  if (*begin == '0' && pos_ - begin > 1 && IsDigit(begin[1])) return false;
+  if (is_integer && pos_ - begin > 18) return false;
+  if (!IsValueEnd(pos_, end_)) return false;
+
+  value_.assign(begin, pos_);
+  char* parsed_end = nullptr;
+  *value = strtod(value_.c_str(), &parsed_end);
+  // Also fails for locales with another decimal point.
+  if (parsed_end != value_.c_str() + value_.size()) return false;
+  if (negative) *value = -*value;
+  return true;
+}
+
+template <class T>
+bool CompactTextParser::ParseInteger(T* value) {
+  bool negative = Consume('-');
+  if (negative && !std::is_signed<T>::value) return false;
+  uint64_t magnitude;
+  if (!ParseDecimal(&magnitude)) return false;
+  uint64_t limit =
+      static_cast<uint64_t>(std::numeric_limits<T>::max()) + negative;
+  if (magnitude > limit) return false;
+  *value = static_cast<T>(negative ? 0 - magnitude : magnitude);
+  return true;
+}
+
+bool CompactTextParser::ParseDecimal(uint64_t* value) {
+  const char* begin = pos_;
+  uint64_t result = 0;
+  for (; pos_ != end_ && IsDigit(*pos_); ++pos_) {
+    uint64_t digit = *pos_ - '0';
+    if (result > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+      return false;
+    result = result * 10 + digit;
+  }
+  if (pos_ == begin) return false;
+  // Leading zeros start octal numbers.
+  if (*begin == '0' && pos_ - begin > 1) return false;
+  // Rejects floats, hex numbers and suffixes.
+  if (!IsValueEnd(pos_, end_)) return false;
+  *value = result;
+  return true;
+}
+
+bool CompactTextParser::ParseString(std::string* value) {
+  if (!Consume('"')) return false;
+  value->clear();
+  for (;;) {
+    const char* begin = pos_;
+    while (pos_ != end_ && *pos_ != '"' && *pos_ != '\\' && IsPrintable(*pos_))
+      ++pos_;
+    value->append(begin, pos_);
+    if (pos_ == end_) return false;
+    char c = *pos_++;
+    if (c == '"') return true;
+    if (c != '\\' || pos_ == end_) return false;
+    c = *pos_++;
+    switch (c) {
+      case 'n':
+        value->push_back('\n');
+        break;
+      case 'r':
+        value->push_back('\r');
+        break;
+      case 't':
+        value->push_back('\t');
+        break;
+      case '"':
+      case '\'':
+      case '\\':
+        value->push_back(c);
+        break;
+      default:
+        // CEscape prints other bytes as three octal digits.
+        if (c < '0' || c > '3' || end_ - pos_ < 2 || !IsOctalDigit(pos_[0]) ||
+            !IsOctalDigit(pos_[1]))
+          return false;
+        value->push_back(static_cast<char>(((c - '0') << 6) |
+                                           ((pos_[0] - '0') << 3) |
+                                           (pos_[1] - '0')));
+        pos_ += 2;
+    }
+  }
+}
+
+bool CompactTextParser::ParseIdentifier(std::string* value) {
+  const char* begin = pos_;
+  if (pos_ == end_ || !IsLetter(*pos_)) return false;
+  while (pos_ != end_ && (IsLetter(*pos_) || IsDigit(*pos_))) ++pos_;
+  value->assign(begin, pos_);
+  return true;
+}
+
+void CompactTextParser::SkipWhitespace() {
+  while (pos_ != end_ && IsWhitespace(*pos_)) ++pos_;
+}
+
+bool CompactTextParser::Consume(char c) {
+  if (pos_ == end_ || *pos_ != c) return false;
+  ++pos_;
+  return true;
+}
+
+}  // namespace protobuf_mutator
@@ -0,0 +1,69 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_TEXT_PARSER_H_
+#define SRC_TEXT_PARSER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "port/protobuf.h"
+
+namespace protobuf_mutator {
+
+struct FieldInfo;
+class MessageInfo;
+
+// Parser of the text format printed by SaveMessageAsText: field names,
+// decimal numbers, identifiers, quoted strings, lists of scalars and nested
+// messages. Any input it accepts is parsed by TextFormat::Parser into the
+// same message, but it rejects everything else, e.g. comments, extensions,
+// hex numbers or overflowing values, so callers must fall back to
+// TextFormat::Parser when it fails.
+//
+// Keeps scratch buffers between calls, so reuse the object.
+class CompactTextParser {
+ public:
+  // Merges |data| into |output|. Returns false if |data| is outside of the
+  // supported subset, |output| is partially merged then.
+  bool Parse(const char* data, size_t size, protobuf::Message* output);
+
+ private:
+  bool ParseMessage(protobuf::Message* message, int depth);
+  bool ParseField(protobuf::Message* message, const MessageInfo& info,
+                  int depth);
+  bool ParseList(protobuf::Message* message, const FieldInfo& field);
+  bool ParseValue(protobuf::Message* message, const FieldInfo& field);
+  bool ParseEnum(protobuf::Message* message, const FieldInfo& field);
+  bool ParseBool(bool* value);
+  bool ParseDouble(double* value);
+  template <class T>
+  bool ParseInteger(T* value);
+  bool ParseDecimal(uint64_t* value);
+  bool ParseString(std::string* value);
+  bool ParseIdentifier(std::string* value);
+  void SkipWhitespace();
+  bool Consume(char c);
+
+  const char* pos_ = nullptr;
+  const char* end_ = nullptr;
+  std::string name_;
+  std::string value_;
+};
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_TEXT_PARSER_H_
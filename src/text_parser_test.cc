@@ -0,0 +1,145 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/text_parser.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "port/gtest.h"
+#include "src/mutator.h"
+#include "src/mutator_test_proto2.pb.h"
+#include "src/mutator_test_proto3.pb.h"
+#include "src/text_format.h"
+
+namespace protobuf_mutator {
+
+// NaN is not equal to itself, so messages are compared in binary.
+std::string Serialize(const protobuf::Message& message) {
+  std::string result;
+  message.SerializePartialToString(&result);
+  return result;
+}
+
+// Returns true if CompactTextParser accepts |text|, and then expects the same
+// message from TextFormat::Parser.
+template <class T>
+bool ParseCompact(const std::string& text) {
+  T compact;
+  if (!CompactTextParser().Parse(text.data(), text.size(), &compact))
+    return false;
+  T expected;
+  protobuf::TextFormat::Parser parser;
+  parser.AllowPartialMessage(true);
+  EXPECT_TRUE(parser.ParseFromString(text, &expected)) << text;
+  EXPECT_EQ(Serialize(expected), Serialize(compact)) << text;
+  return true;
+}
+
+template <class T>
+class CompactTextParserTest : public testing::Test {};
+
+using MessageTypes = testing::Types<Msg, Msg3>;
+TYPED_TEST_CASE(CompactTextParserTest, MessageTypes);
+
+TYPED_TEST(CompactTextParserTest, ParsesPrintedMessages) {
+  RandomEngine random(5);
+  Mutator mutator(&random);
+  for (int i = 0; i < 1000; ++i) {
+    TypeParam message;
+    for (int j = 0; j < 10; ++j) mutator.Mutate(&message, 1000);
+    std::string text = SaveMessageAsText(message);
+    EXPECT_TRUE(ParseCompact<TypeParam>(text)) << text;
+  }
+}
+
+TYPED_TEST(CompactTextParserTest, Accepts) {
+  const char* kInputs[] = {
+      "",
+      "  \n\t",
+      "optional_int32: -2147483648 optional_uint32: 4294967295",
+      "optional_int64: -9223372036854775808",
+      "optional_uint64: 18446744073709551615",
+      "optional_double: -1.5e-300 optional_float: 1e+39",
+      "optional_float: -inf optional_double: nan",
+      "optional_double: -0",
+      "optional_bool: true repeated_bool: [false, true]",
+      "optional_enum: ENUM_3 repeated_enum: [1, ENUM_2]",
+      "optional_bytes: \"\\\"\\'\\\\\\n\\r\\t\\000\\377\"",
+      "repeated_int32: [] repeated_int32: [ 1 ,2 ] repeated_int32: 3",
+      "optional_msg { optional_msg: { } } repeated_msg {}",
+      "oneof_msg { oneof_string: \"a\" }",
+  };
+  for (const char* input : kInputs)
+    EXPECT_TRUE(ParseCompact<TypeParam>(input)) << input;
+}
+
+TYPED_TEST(CompactTextParserTest, Rejects) {
+  const char* kInputs[] = {
+      // Valid, but left to TextFormat::Parser.
+      "optional_int32: 0x10",
+      "optional_int32: 010",
+      "optional_int32: - 1",
+      "optional_double: 1.5f",
+      "optional_double: Infinity",
+      "optional_double: 123456789012345678901",
+      "optional_bool: True",
+      "optional_string: 'a'",
+      "optional_string: \"a\" \"b\"",
+      "optional_string: \"\\x41\"",
+      "optional_msg < >",
+      "optional_int32: 1; optional_uint32: 2",
+      "# comment",
+      // Invalid.
+      "optional_int32: 2147483648",
+      "optional_uint32: -1",
+      "optional_int32: 1a",
+      "optional_uint64: 1.0e3",
+      "optional_string: \"\n\"",
+      "optional_string: \"a",
+      "optional_enum: ENUM_10",
+      "optional_int32 1",
+      "optional_int32: 1 optional_int32: 2",
+      "oneof_double: 1 oneof_string: \"a\"",
+      "optional_msg {",
+      "}",
+      "unknown: 1",
+  };
+  for (const char* input : kInputs) {
+    TypeParam message;
+    EXPECT_FALSE(CompactTextParser().Parse(input, strlen(input), &message))
+        << input;
+  }
+}
+
+TEST(CompactTextParserTest, Fallback) {
+  Msg message;
+  EXPECT_TRUE(ParseTextMessage("optional_int32: 0x10 # comment", &message));
+  EXPECT_EQ(16, message.optional_int32());
+  EXPECT_FALSE(ParseTextMessage("optional_int32: 1 optional_int32: 2",
+                                &message));
+  EXPECT_FALSE(message.has_optional_int32());
+}
+
+TEST(CompactTextParserTest, MaxDepth) {
+  std::string text;
+  for (int i = 0; i < 200; ++i) text += "optional_msg {";
+  text += std::string(200, '}');
+  EXPECT_FALSE(ParseCompact<Msg>(text));
+  Msg message;
+  EXPECT_TRUE(ParseTextMessage(text, &message));
+}
+
+}  // namespace protobuf_mutator
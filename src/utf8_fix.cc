@@ -15,13 +15,48 @@
 
 #include "src/utf8_fix.h"
 
+#include <string.h>
+
 #include <algorithm>
 #include <cassert>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace protobuf_mutator {
 
 namespace {
 
+bool IsContinuation(char c) { return (c & 0xC0) == 0x80; }
+
+// Returns the first non-ASCII byte in [b, e), or e. FixCode leaves ASCII bytes
+// unchanged and never takes them as part of a preceding code point, so they
+// can be skipped between code points.
+char* SkipAscii(char* b, const char* e) {
+#if defined(__AVX2__)
+  for (; e - b >= 32; b += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+    if (int mask = _mm256_movemask_epi8(chunk)) return b + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; e - b >= 16; b += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    if (int mask = _mm_movemask_epi8(chunk)) return b + __builtin_ctz(mask);
+  }
+#endif
+  for (; e - b >= 8; b += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, b, sizeof(chunk));
+    if (chunk & 0x8080808080808080ull) break;
+  }
+  while (b < e && !(*b & 0x80)) ++b;
+  return b;
+}
+
 void StoreCode(char* e, char32_t code, uint8_t size, uint8_t prefix) {
   while (--size) {
     *(--e) = 0x80 | (code & 0x3F);
@@ -77,9 +112,45 @@ char* FixCode(char* b, const char* e, RandomEngine* random) {
   return b;
 }
 
+void FixUtf8Range(char* b, const char* e, RandomEngine* random) {
+  while (b < e) {
+    char* next = SkipAscii(b, e);
+    // FixCode takes continuation bytes after ASCII as part of its sequence.
+    if (next != b && next < e && IsContinuation(*next)) --next;
+    if (next == e) return;
+    b = FixCode(next, e, random);
+  }
+}
+
 }  // namespace
 
 void FixUtf8String(std::string* str, RandomEngine* random) {
+  if (str->empty()) return;
+  char* b = &(*str)[0];
+  FixUtf8Range(b, b + str->size(), random);
+}
+
+void FixUtf8String(std::string* str, size_t begin, size_t end,
+                   RandomEngine* random) {
+  assert(begin <= end);
+  assert(end <= str->size());
+  // Code point before the range may be truncated, e.g. by deletion.
+  if (begin) {
+    size_t lead = begin - 1;
+    while (lead && begin - lead < 4 && IsContinuation((*str)[lead])) --lead;
+    begin = lead;
+  }
+  // Continuation bytes after the range may have lost their lead.
+  for (size_t i = 0; i < 3 && end < str->size() && IsContinuation((*str)[end]);
+       ++i) {
+    ++end;
+  }
+  if (begin == end) return;
+  char* b = &(*str)[0];
+  FixUtf8Range(b + begin, b + end, random);
+}
+
+void FixUtf8StringScalar(std::string* str, RandomEngine* random) {
   if (str->empty()) return;
   char* b = &(*str)[0];
   const char* e = b + str->size();
@@ -16,14 +16,28 @@
 #ifndef SRC_UTF8_FIX_H_
 #define SRC_UTF8_FIX_H_
 
+#include <stddef.h>
+
 #include <string>
 
 #include "src/random.h"
 
 namespace protobuf_mutator {
 
+// Replaces invalid UTF-8 sequences of |str| with random valid code points.
+// Valid sequences are not changed. Runs of ASCII are skipped with SSE2 or
+// AVX2, if the target supports them.
 void FixUtf8String(std::string* str, RandomEngine* random);
 
+// Same as above, but fixes only bytes in [begin, end) and code points which
+// cross the boundaries of the range. The rest of |str| must be valid UTF-8,
+// e.g. if only the range was changed since the last fix.
+void FixUtf8String(std::string* str, size_t begin, size_t end,
+                   RandomEngine* random);
+
+// Same as FixUtf8String, but checks every byte. Reference for tests.
+void FixUtf8StringScalar(std::string* str, RandomEngine* random);
+
 }  // namespace protobuf_mutator
 
 #endif  // SRC_UTF8_FIX_H_
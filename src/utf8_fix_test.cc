@@ -61,4 +61,57 @@ TEST_P(FixUtf8StringTest, FixUtf8String) {
   }
 }
 
+TEST_P(FixUtf8StringTest, EquivalentToScalar) {
+  RandomEngine random(GetParam());
+  std::uniform_int_distribution<uint8_t> random8(0, 0xFF);
+
+  for (uint32_t run = 0; run < 10000; ++run) {
+    // Mostly ASCII, to exercise vectorized skipping.
+    std::string str(random8(random), 0);
+    for (size_t i = 0; i < str.size(); ++i) {
+      str[i] = random8(random);
+      if (random8(random) < 0xE0) str[i] &= 0x7F;
+    }
+    std::string fixed = str;
+    std::string expected = str;
+    RandomEngine random1(run);
+    RandomEngine random2(run);
+    FixUtf8String(&fixed, &random1);
+    FixUtf8StringScalar(&expected, &random2);
+    EXPECT_EQ(expected, fixed);
+  }
+}
+
+TEST_P(FixUtf8StringTest, FixRange) {
+  RandomEngine random(GetParam());
+  std::uniform_int_distribution<uint8_t> random8(0, 0xFF);
+
+  for (uint32_t run = 0; run < 10000; ++run) {
+    std::string str(random8(random), 0);
+    for (size_t i = 0; i < str.size(); ++i) str[i] = random8(random);
+    FixUtf8String(&str, &random);
+    ASSERT_TRUE(IsStructurallyValid(str));
+
+    // Replace a range with random bytes of different size.
+    size_t begin = std::uniform_int_distribution<size_t>(0, str.size())(random);
+    size_t end =
+        std::uniform_int_distribution<size_t>(begin, str.size())(random);
+    std::string bytes(random8(random) % 8, 0);
+    for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = random8(random);
+    std::string mutated = str;
+    mutated.replace(begin, end - begin, bytes);
+
+    std::string fixed = mutated;
+    FixUtf8String(&fixed, begin, begin + bytes.size(), &random);
+    EXPECT_TRUE(IsStructurallyValid(fixed));
+    // Only code points at boundaries of the range may change outside of it.
+    size_t prefix = begin > 3 ? begin - 3 : 0;
+    EXPECT_EQ(mutated.substr(0, prefix), fixed.substr(0, prefix));
+    size_t suffix = begin + bytes.size() + 3;
+    if (suffix < mutated.size()) {
+      EXPECT_EQ(mutated.substr(suffix), fixed.substr(suffix));
+    }
+  }
+}
+
 }  // namespace protobuf_mutator
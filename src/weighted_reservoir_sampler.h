@@ -16,8 +16,13 @@
 #ifndef SRC_WEIGHTED_RESERVOIR_SAMPLER_H_
 #define SRC_WEIGHTED_RESERVOIR_SAMPLER_H_
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <random>
+#include <vector>
+
+#include "src/random.h"
 
 namespace protobuf_mutator {
 
@@ -46,12 +51,168 @@ class WeightedReservoirSampler {
   bool Pick(uint64_t weight) {
     if (weight == 0) return false;
     total_weight_ += weight;
-    return weight == total_weight_ || std::uniform_int_distribution<uint64_t>(
-                                          1, total_weight_)(*random_) <= weight;
+    return weight == total_weight_ ||
+           GetRandomUInt64(random_, total_weight_) < weight;
+  }
+
+  T selected_ = {};
+  uint64_t total_weight_ = 0;
+  RandomEngine* random_;
+};
+
+// Same as WeightedReservoirSampler, but draws random numbers only when the
+// selected item is replaced. After selection at total weight W, the next item
+// is selected when total weight reaches W / U, U from (0, 1]. The probability
+// to keep the item over the following items is the same as with per-item draws,
+// so distribution is the same, with O(log N) random numbers for N items of
+// similar weights.
+// https://en.wikipedia.org/wiki/Reservoir_sampling#Algorithm_A-ExpJ
+template <class T, class RandomEngine = std::default_random_engine>
+class WeightedReservoirSkipSampler {
+ public:
+  explicit WeightedReservoirSkipSampler(RandomEngine* random)
+      : random_(random) {}
+
+  void Try(uint64_t weight, const T& item) {
+    if (weight == 0) return;
+    total_weight_ += weight;
+    if (total_weight_ < threshold_) return;
+    selected_ = item;
+    threshold_ = total_weight_ / GetRandomUnit(random_);
   }
 
+  const T& selected() const { return selected_; }
+
+  bool IsEmpty() const { return total_weight_ == 0; }
+
+ private:
   T selected_ = {};
   uint64_t total_weight_ = 0;
+  // Total weight which selects the next item.
+  double threshold_ = 0;
+  RandomEngine* random_;
+};
+
+// Picks items with fixed weights in O(1) per pick, after O(N) construction.
+// Useful when weights don't change between many picks.
+// https://en.wikipedia.org/wiki/Alias_method
+//
+// Example:
+//   WeightedAliasTable table(weights);
+//   for(int i = 0; i < count; ++i)
+//     Use(table.Pick(&random));
+class WeightedAliasTable {
+ public:
+  explicit WeightedAliasTable(const std::vector<uint64_t>& weights)
+      : columns_(weights.size()) {
+    for (uint64_t weight : weights) total_weight_ += weight;
+    if (!total_weight_) return;
+
+    // Vose's method in integers. Column i is split at threshold, into
+    // [0, threshold) for i and [threshold, total_weight_) for alias, and every
+    // weight is scaled by number of columns.
+    using Scaled = unsigned __int128;
+    const size_t n = weights.size();
+    std::vector<Scaled> scaled(n);
+    std::vector<size_t> small;
+    std::vector<size_t> large;
+    for (size_t i = 0; i < n; ++i) {
+      scaled[i] = static_cast<Scaled>(weights[i]) * n;
+      (scaled[i] < total_weight_ ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      size_t s = small.back();
+      small.pop_back();
+      size_t l = large.back();
+      columns_[s] = {static_cast<uint64_t>(scaled[s]), l};
+      scaled[l] -= total_weight_ - scaled[s];
+      if (scaled[l] < total_weight_) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // Integer arithmetic leaves only full columns.
+    for (size_t i : large) columns_[i] = {total_weight_, i};
+    for (size_t i : small) {
+      assert(scaled[i] == total_weight_);
+      columns_[i] = {total_weight_, i};
+    }
+  }
+
+  // Returns index of the picked weight. Table must not be empty.
+  template <class RandomEngine>
+  size_t Pick(RandomEngine* random) const {
+    assert(!IsEmpty());
+    const Column& column = columns_[GetRandomUInt64(random, columns_.size())];
+    return GetRandomUInt64(random, total_weight_) < column.threshold
+               ? &column - columns_.data()
+               : column.alias;
+  }
+
+  bool IsEmpty() const { return total_weight_ == 0; }
+
+ private:
+  struct Column {
+    uint64_t threshold;
+    size_t alias;
+  };
+
+  std::vector<Column> columns_;
+  uint64_t total_weight_ = 0;
+};
+
+// Algorithm picks up to |count| distinct items from the sequence of weighted
+// items, as if items were drawn one by one without replacement.
+// https://en.wikipedia.org/wiki/Reservoir_sampling#Algorithm_A-Res
+//
+// Example:
+//   WeightedReservoirMultiSampler<int> sampler(3, &random);
+//   for(int i = 0; i < size; ++i)
+//     sampler.Try(weight[i], i);
+//   return sampler.selected();
+template <class T, class RandomEngine = std::default_random_engine>
+class WeightedReservoirMultiSampler {
+ public:
+  WeightedReservoirMultiSampler(size_t count, RandomEngine* random)
+      : count_(count), random_(random) {}
+
+  void Try(uint64_t weight, const T& item) {
+    if (weight == 0 || count_ == 0) return;
+    // Exp(1) / weight, without std::exponential_distribution which differs
+    // between standard libraries. Items with the smallest keys are selected.
+    double key = -std::log(GetRandomUnit(random_)) / weight;
+    if (heap_.size() == count_) {
+      if (key >= heap_.front().key) return;
+      std::pop_heap(heap_.begin(), heap_.end());
+      heap_.pop_back();
+    }
+    heap_.push_back({key, item});
+    std::push_heap(heap_.begin(), heap_.end());
+  }
+
+  // Returns selected items in the order of drawing.
+  std::vector<T> selected() const {
+    std::vector<Entry> entries = heap_;
+    std::sort_heap(entries.begin(), entries.end());
+    std::vector<T> result;
+    result.reserve(entries.size());
+    for (const Entry& entry : entries) result.push_back(entry.item);
+    return result;
+  }
+
+  bool IsEmpty() const { return heap_.empty(); }
+
+ private:
+  struct Entry {
+    bool operator<(const Entry& other) const { return key < other.key; }
+
+    double key;
+    T item;
+  };
+
+  size_t count_;
+  // Max-heap by key.
+  std::vector<Entry> heap_;
   RandomEngine* random_;
 };
 
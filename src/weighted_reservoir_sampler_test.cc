@@ -15,6 +15,8 @@
 
 #include "src/weighted_reservoir_sampler.h"
 
+#include <algorithm>
+#include <set>
 #include <tuple>
 #include <vector>
 
@@ -73,4 +75,142 @@ TEST_P(WeightedReservoirSamplerTest, Test) {
   }
 }
 
+class WeightedReservoirSkipSamplerTest
+    : public TestWithParam<std::tuple<int, std::vector<int>>> {};
+
+INSTANTIATE_TEST_CASE_P(AllTest, WeightedReservoirSkipSamplerTest,
+                        Combine(Range(1, 10, 3), ValuesIn(kTests)));
+
+TEST_P(WeightedReservoirSkipSamplerTest, Test) {
+  std::vector<int> weights = std::get<1>(GetParam());
+  std::vector<int> counts(weights.size(), 0);
+
+  RandomEngine rand(std::get<0>(GetParam()));
+  for (int i = 0; i < kRuns; ++i) {
+    WeightedReservoirSkipSampler<int, RandomEngine> sampler(&rand);
+    for (size_t j = 0; j < weights.size(); ++j) sampler.Try(weights[j], j);
+    ++counts[sampler.selected()];
+  }
+
+  int sum = std::accumulate(weights.begin(), weights.end(), 0);
+  for (size_t j = 0; j < weights.size(); ++j) {
+    float expected = weights[j];
+    expected /= sum;
+
+    float actual = counts[j];
+    actual /= kRuns;
+
+    EXPECT_NEAR(expected, actual, 0.01);
+  }
+}
+
+// Counts random numbers drawn from std::mt19937.
+class CountingEngine : public std::mt19937 {
+ public:
+  using std::mt19937::mt19937;
+
+  result_type operator()() {
+    ++calls;
+    return std::mt19937::operator()();
+  }
+
+  size_t calls = 0;
+};
+
+TEST(WeightedReservoirSkipSamplerTest, RandomCalls) {
+  CountingEngine rand(1);
+  const int kItems = 100000;
+  const int kSamples = 100;
+  for (int i = 0; i < kSamples; ++i) {
+    WeightedReservoirSkipSampler<int, CountingEngine> sampler(&rand);
+    for (int j = 0; j < kItems; ++j) sampler.Try(1, j);
+  }
+  // Expected number of selections is ln(kItems) + 1, about 12, with two 32-bit
+  // numbers per double.
+  EXPECT_LT(rand.calls, 2u * 20 * kSamples);
+}
+
+class WeightedAliasTableTest
+    : public TestWithParam<std::tuple<int, std::vector<int>>> {};
+
+INSTANTIATE_TEST_CASE_P(AllTest, WeightedAliasTableTest,
+                        Combine(Range(1, 10, 3), ValuesIn(kTests)));
+
+TEST_P(WeightedAliasTableTest, Test) {
+  std::vector<int> weights = std::get<1>(GetParam());
+  std::vector<int> counts(weights.size(), 0);
+
+  RandomEngine rand(std::get<0>(GetParam()));
+  WeightedAliasTable table(
+      std::vector<uint64_t>(weights.begin(), weights.end()));
+  ASSERT_FALSE(table.IsEmpty());
+  for (int i = 0; i < kRuns; ++i) ++counts[table.Pick(&rand)];
+
+  int sum = std::accumulate(weights.begin(), weights.end(), 0);
+  for (size_t j = 0; j < weights.size(); ++j) {
+    float expected = weights[j];
+    expected /= sum;
+
+    float actual = counts[j];
+    actual /= kRuns;
+
+    EXPECT_NEAR(expected, actual, 0.01);
+    if (!weights[j]) {
+      EXPECT_EQ(0, counts[j]);
+    }
+  }
+}
+
+TEST(WeightedAliasTableTest, Empty) {
+  EXPECT_TRUE(WeightedAliasTable({}).IsEmpty());
+  EXPECT_TRUE(WeightedAliasTable({0, 0}).IsEmpty());
+}
+
+class WeightedReservoirMultiSamplerTest
+    : public TestWithParam<std::tuple<int, std::vector<int>>> {};
+
+INSTANTIATE_TEST_CASE_P(AllTest, WeightedReservoirMultiSamplerTest,
+                        Combine(Range(1, 10, 3), ValuesIn(kTests)));
+
+TEST_P(WeightedReservoirMultiSamplerTest, Test) {
+  std::vector<int> weights = std::get<1>(GetParam());
+  std::vector<int> first_counts(weights.size(), 0);
+  size_t non_zero =
+      weights.size() - std::count(weights.begin(), weights.end(), 0);
+
+  using RandomEngine = std::mt19937;
+  RandomEngine rand(std::get<0>(GetParam()));
+  const int kMultiRuns = kRuns / 10;
+  for (int i = 0; i < kMultiRuns; ++i) {
+    WeightedReservoirMultiSampler<int, RandomEngine> sampler(3, &rand);
+    for (size_t j = 0; j < weights.size(); ++j) sampler.Try(weights[j], j);
+    std::vector<int> selected = sampler.selected();
+    ASSERT_EQ(std::min<size_t>(3, non_zero), selected.size());
+    std::set<int> unique(selected.begin(), selected.end());
+    EXPECT_EQ(selected.size(), unique.size());
+    for (int j : selected) EXPECT_NE(0, weights[j]);
+    // The first item is distributed as with WeightedReservoirSampler.
+    ++first_counts[selected.front()];
+  }
+
+  int sum = std::accumulate(weights.begin(), weights.end(), 0);
+  for (size_t j = 0; j < weights.size(); ++j) {
+    float expected = weights[j];
+    expected /= sum;
+
+    float actual = first_counts[j];
+    actual /= kMultiRuns;
+
+    EXPECT_NEAR(expected, actual, 0.01);
+  }
+}
+
+TEST(WeightedReservoirMultiSamplerTest, Empty) {
+  std::mt19937 rand(1);
+  WeightedReservoirMultiSampler<int, std::mt19937> sampler(0, &rand);
+  sampler.Try(1, 1);
+  EXPECT_TRUE(sampler.IsEmpty());
+  EXPECT_TRUE(sampler.selected().empty());
+}
+
 }  // namespace protobuf_mutator
@@ -0,0 +1,610 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/wire_mutator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "src/message_info.h"
+#include "src/utf8_fix.h"
+#include "src/weighted_reservoir_sampler.h"
+
+namespace protobuf_mutator {
+
+using protobuf::Descriptor;
+using protobuf::FieldDescriptor;
+
+namespace {
+
+// Same as default recursion limit of the protobuf parser.
+const int kMaxNestingDepth = 100;
+const int kMaxAttempts = 10;
+const uint64_t kMaxFieldNumber = (1 << 29) - 1;
+
+enum WireType {
+  WIRETYPE_VARINT = 0,
+  WIRETYPE_FIXED64 = 1,
+  WIRETYPE_LENGTH_DELIMITED = 2,
+  WIRETYPE_START_GROUP = 3,
+  WIRETYPE_END_GROUP = 4,
+  WIRETYPE_FIXED32 = 5,
+};
+
+enum class Mutation {
+  None,
+  Add,     // Inserts new field with default value.
+  Mutate,  // Mutates field value.
+  Delete,  // Deletes field.
+  Copy,    // Copies value from another field of the same type.
+};
+
+size_t VarintSize(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7) ++size;
+  return size;
+}
+
+void AppendVarint(uint64_t value, std::string* out) {
+  for (; value >= 0x80; value >>= 7)
+    out->push_back(static_cast<char>(value | 0x80));
+  out->push_back(static_cast<char>(value));
+}
+
+bool ReadVarint(const uint8_t* data, size_t end, size_t* pos,
+                uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+    uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+// Returns wire type of a single, not packed, value of the field.
+WireType GetWireType(const FieldDescriptor& field) {
+  switch (field.type()) {
+    case FieldDescriptor::TYPE_DOUBLE:
+    case FieldDescriptor::TYPE_FIXED64:
+    case FieldDescriptor::TYPE_SFIXED64:
+      return WIRETYPE_FIXED64;
+    case FieldDescriptor::TYPE_FLOAT:
+    case FieldDescriptor::TYPE_FIXED32:
+    case FieldDescriptor::TYPE_SFIXED32:
+      return WIRETYPE_FIXED32;
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+    case FieldDescriptor::TYPE_MESSAGE:
+      return WIRETYPE_LENGTH_DELIMITED;
+    case FieldDescriptor::TYPE_GROUP:
+      return WIRETYPE_START_GROUP;
+    default:
+      return WIRETYPE_VARINT;
+  }
+}
+
+// Appends encoded default value of the field.
+void AppendDefaultValue(const FieldDescriptor& field, std::string* out) {
+  switch (field.type()) {
+    case FieldDescriptor::TYPE_DOUBLE: {
+      double value = field.default_value_double();
+      out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case FieldDescriptor::TYPE_FLOAT: {
+      float value = field.default_value_float();
+      out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case FieldDescriptor::TYPE_FIXED64: {
+      uint64_t value = field.default_value_uint64();
+      out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case FieldDescriptor::TYPE_SFIXED64: {
+      int64_t value = field.default_value_int64();
+      out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case FieldDescriptor::TYPE_FIXED32: {
+      uint32_t value = field.default_value_uint32();
+      out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case FieldDescriptor::TYPE_SFIXED32: {
+      int32_t value = field.default_value_int32();
+      out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+      return;
+    }
+    case FieldDescriptor::TYPE_INT32:
+      return AppendVarint(static_cast<int64_t>(field.default_value_int32()),
+                          out);
+    case FieldDescriptor::TYPE_INT64:
+      return AppendVarint(field.default_value_int64(), out);
+    case FieldDescriptor::TYPE_UINT32:
+      return AppendVarint(field.default_value_uint32(), out);
+    case FieldDescriptor::TYPE_UINT64:
+      return AppendVarint(field.default_value_uint64(), out);
+    case FieldDescriptor::TYPE_SINT32:
+      return AppendVarint(ZigZagEncode(field.default_value_int32()), out);
+    case FieldDescriptor::TYPE_SINT64:
+      return AppendVarint(ZigZagEncode(field.default_value_int64()), out);
+    case FieldDescriptor::TYPE_BOOL:
+      return AppendVarint(field.default_value_bool(), out);
+    case FieldDescriptor::TYPE_ENUM:
+      return AppendVarint(
+          static_cast<int64_t>(field.default_value_enum()->number()), out);
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+      AppendVarint(field.default_value_string().size(), out);
+      out->append(field.default_value_string());
+      return;
+    case FieldDescriptor::TYPE_MESSAGE:
+      return AppendVarint(0, out);
+    case FieldDescriptor::TYPE_GROUP:
+      break;
+  }
+  assert(false && "unexpected type");
+}
+
+// Returns true if value of |source| can be copied into |destination| as is.
+bool IsSameValueType(const FieldDescriptor& source,
+                     const FieldDescriptor& destination) {
+  if (source.type() != destination.type()) return false;
+  if (source.message_type() != destination.message_type()) return false;
+  if (source.enum_type() != destination.enum_type()) return false;
+  return !IsUtf8Field(destination) || IsUtf8Field(source);
+}
+
+// Binary encoded message with index of its fields.
+class WireMessage {
+ public:
+  struct Entry {
+    // Nullptr for unknown fields.
+    const FieldDescriptor* field;
+    // Containing node.
+    int node;
+    WireType wire_type;
+    // Start of the tag.
+    size_t begin;
+    // End of the tag.
+    size_t value_begin;
+    // End of the length prefix, or value_begin if there is no prefix.
+    size_t payload_begin;
+    size_t end;
+  };
+
+  struct Node {
+    const Descriptor* descriptor;
+    // Entry which contains the message, -1 for the root.
+    int parent;
+    // End of the encoded message.
+    size_t end;
+    std::vector<int> entries;
+  };
+
+  WireMessage(uint8_t* data, size_t size, size_t max_size)
+      : data_(data), size_(size), max_size_(max_size) {}
+
+  // Returns false if data is not valid encoding of the message.
+  bool Index(const Descriptor* descriptor) {
+    return IndexNode(descriptor, 0, size_, -1, 0);
+  }
+
+  const std::vector<Node>& nodes() const { return nodes_; }
+  const std::vector<Entry>& entries() const { return entries_; }
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  size_t max_size() const { return max_size_; }
+
+  std::string Bytes(size_t begin, size_t end) const {
+    return std::string(reinterpret_cast<const char*>(data_ + begin),
+                       end - begin);
+  }
+
+  // Replaces |length| bytes at |pos| inside of the |node| with |value| and
+  // updates length prefixes of containing messages. Returns false and keeps
+  // data unchanged if the result does not fit into max_size().
+  bool Replace(int node, size_t pos, size_t length, const std::string& value) {
+    struct Prefix {
+      size_t pos;
+      size_t size;
+      uint64_t length;
+    };
+    std::vector<Prefix> prefixes;
+    int64_t delta =
+        static_cast<int64_t>(value.size()) - static_cast<int64_t>(length);
+    for (int parent = nodes_[node].parent; parent >= 0;
+         parent = nodes_[entries_[parent].node].parent) {
+      const Entry& entry = entries_[parent];
+      uint64_t new_length = entry.end - entry.payload_begin + delta;
+      size_t size = entry.payload_begin - entry.value_begin;
+      prefixes.push_back({entry.value_begin, size, new_length});
+      delta += static_cast<int64_t>(VarintSize(new_length)) -
+               static_cast<int64_t>(size);
+    }
+    if (static_cast<int64_t>(size_) + delta > static_cast<int64_t>(max_size_))
+      return false;
+
+    Splice(pos, length, value);
+    // Prefixes precede the change, inner prefixes follow outer ones.
+    for (const Prefix& prefix : prefixes) {
+      std::string encoded;
+      AppendVarint(prefix.length, &encoded);
+      Splice(prefix.pos, prefix.size, encoded);
+    }
+    return true;
+  }
+
+  // Replaces bytes without updating length prefixes.
+  bool Splice(size_t pos, size_t length, const std::string& value) {
+    assert(pos + length <= size_);
+    if (size_ - length + value.size() > max_size_) return false;
+    memmove(data_ + pos + value.size(), data_ + pos + length,
+            size_ - pos - length);
+    if (!value.empty()) memcpy(data_ + pos, value.data(), value.size());
+    size_ = size_ - length + value.size();
+    return true;
+  }
+
+  void Truncate(size_t size) {
+    assert(size <= size_);
+    size_ = size;
+  }
+
+ private:
+  bool IndexNode(const Descriptor* descriptor, size_t begin, size_t end,
+                 int parent, int depth) {
+    if (depth > kMaxNestingDepth) return false;
+    int node = nodes_.size();
+    nodes_.push_back({descriptor, parent, end, {}});
+
+    for (size_t pos = begin; pos < end;) {
+      Entry entry = {};
+      entry.node = node;
+      entry.begin = pos;
+      uint64_t tag;
+      if (!ReadVarint(data_, end, &pos, &tag)) return false;
+      uint64_t number = tag >> 3;
+      if (!number || number > kMaxFieldNumber) return false;
+      entry.wire_type = static_cast<WireType>(tag & 7);
+      entry.value_begin = pos;
+      if (!SkipValue(entry.wire_type, number, end, depth, &pos,
+                     &entry.payload_begin)) {
+        return false;
+      }
+      entry.end = pos;
+
+      entry.field = descriptor->FindFieldByNumber(number);
+      if (entry.field && !IsExpectedWireType(*entry.field, entry.wire_type))
+        entry.field = nullptr;
+
+      int index = entries_.size();
+      entries_.push_back(entry);
+      nodes_[node].entries.push_back(index);
+
+      if (entry.field &&
+          entry.field->type() == FieldDescriptor::TYPE_MESSAGE &&
+          !IndexNode(entry.field->message_type(), entry.payload_begin,
+                     entry.end, index, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Moves |pos| to the end of the value of |wire_type|.
+  bool SkipValue(WireType wire_type, uint64_t number, size_t end, int depth,
+                 size_t* pos, size_t* payload_begin) {
+    uint64_t value;
+    *payload_begin = *pos;
+    switch (wire_type) {
+      case WIRETYPE_VARINT:
+        return ReadVarint(data_, end, pos, &value);
+      case WIRETYPE_FIXED64:
+        *pos += 8;
+        return *pos <= end;
+      case WIRETYPE_FIXED32:
+        *pos += 4;
+        return *pos <= end;
+      case WIRETYPE_LENGTH_DELIMITED:
+        if (!ReadVarint(data_, end, pos, &value)) return false;
+        *payload_begin = *pos;
+        if (value > end - *pos) return false;
+        *pos += value;
+        return true;
+      case WIRETYPE_START_GROUP:
+        if (depth > kMaxNestingDepth) return false;
+        while (*pos < end) {
+          uint64_t tag;
+          if (!ReadVarint(data_, end, pos, &tag)) return false;
+          WireType nested = static_cast<WireType>(tag & 7);
+          if (nested == WIRETYPE_END_GROUP) return (tag >> 3) == number;
+          size_t unused;
+          if (!SkipValue(nested, tag >> 3, end, depth + 1, pos, &unused))
+            return false;
+        }
+        return false;
+      default:
+        return false;
+    }
+  }
+
+  static bool IsExpectedWireType(const FieldDescriptor& field,
+                                 WireType wire_type) {
+    WireType expected = GetWireType(field);
+    if (wire_type == expected) return true;
+    // Repeated scalars are accepted both packed and not packed.
+    return field.is_repeated() && wire_type == WIRETYPE_LENGTH_DELIMITED &&
+           expected != WIRETYPE_LENGTH_DELIMITED &&
+           expected != WIRETYPE_START_GROUP;
+  }
+
+  uint8_t* data_;
+  size_t size_;
+  size_t max_size_;
+  std::vector<Node> nodes_;
+  std::vector<Entry> entries_;
+};
+
+// Mutation bound to a node or an entry of WireMessage.
+struct Candidate {
+  Mutation mutation = Mutation::None;
+  int node = -1;
+  int entry = -1;
+  // Field to add.
+  const FieldDescriptor* field = nullptr;
+};
+
+// Flips random bit of the value in [begin, end). Varints keep the
+// continuation bits.
+void FlipValueBit(WireType wire_type, size_t begin, size_t end, uint8_t* data,
+                  RandomEngine* random) {
+  assert(begin < end);
+  size_t byte = begin + GetRandomIndex(random, end - begin);
+  size_t bits = wire_type == WIRETYPE_VARINT ? 7 : 8;
+  data[byte] ^= 1 << GetRandomIndex(random, bits);
+}
+
+void MutateBytes(std::string* value, RandomEngine* random) {
+  switch (value->empty() ? 0 : GetRandomIndex(random, 3)) {
+    case 0:
+      value->insert(value->begin() + GetRandomIndex(random, value->size() + 1),
+                    static_cast<char>(GetRandomIndex(random, 1 << 8)));
+      break;
+    case 1:
+      value->erase(GetRandomIndex(random, value->size()), 1);
+      break;
+    default:
+      (*value)[GetRandomIndex(random, value->size())] ^=
+          1 << GetRandomIndex(random, 8);
+      break;
+  }
+}
+
+class WireMutation {
+ public:
+  WireMutation(WireMessage* message, RandomEngine* random)
+      : message_(message), random_(random) {}
+
+  Candidate Sample() {
+    WeightedReservoirSkipSampler<Candidate, RandomEngine> sampler(random_);
+    const auto& nodes = message_->nodes();
+    const auto& entries = message_->entries();
+    for (size_t n = 0; n < nodes.size(); ++n) {
+      const WireMessage::Node& node = nodes[n];
+      const Descriptor* descriptor = node.descriptor;
+      std::vector<bool> present(descriptor->field_count());
+      std::vector<bool> oneof_present(descriptor->oneof_decl_count());
+      for (int e : node.entries) {
+        const FieldDescriptor* field = entries[e].field;
+        if (!field) {
+          sampler.Try(1, {Mutation::Delete, static_cast<int>(n), e, nullptr});
+          continue;
+        }
+        present[field->index()] = true;
+        if (field->containing_oneof())
+          oneof_present[field->containing_oneof()->index()] = true;
+        if (field->type() != FieldDescriptor::TYPE_GROUP) {
+          if (field->type() != FieldDescriptor::TYPE_MESSAGE)
+            sampler.Try(1, {Mutation::Mutate, static_cast<int>(n), e, field});
+          sampler.Try(1, {Mutation::Copy, static_cast<int>(n), e, field});
+        }
+        if (!field->is_required())
+          sampler.Try(1, {Mutation::Delete, static_cast<int>(n), e, field});
+      }
+      for (int i = 0; i < descriptor->field_count(); ++i) {
+        const FieldDescriptor* field = descriptor->field(i);
+        if (field->type() == FieldDescriptor::TYPE_GROUP) continue;
+        if (!field->is_repeated()) {
+          if (present[i]) continue;
+          if (field->containing_oneof() &&
+              oneof_present[field->containing_oneof()->index()]) {
+            continue;
+          }
+        }
+        sampler.Try(1, {Mutation::Add, static_cast<int>(n), -1, field});
+      }
+    }
+    return sampler.selected();
+  }
+
+  bool Apply(const Candidate& candidate) {
+    switch (candidate.mutation) {
+      case Mutation::Add:
+        return Add(candidate.node, *candidate.field);
+      case Mutation::Delete: {
+        const WireMessage::Entry& entry =
+            message_->entries()[candidate.entry];
+        return message_->Replace(entry.node, entry.begin,
+                                 entry.end - entry.begin, {});
+      }
+      case Mutation::Mutate:
+        return Mutate(message_->entries()[candidate.entry]);
+      case Mutation::Copy:
+        return Copy(candidate.entry);
+      default:
+        return false;
+    }
+  }
+
+  // Applies mutation which may break the encoding.
+  bool ApplyMalformed() {
+    size_t size = message_->size();
+    switch (GetRandomIndex(random_, 4)) {
+      case 0: {
+        if (!size) return false;
+        message_->Truncate(GetRandomIndex(random_, size));
+        return true;
+      }
+      case 1: {
+        // Wrong length prefix.
+        std::vector<const WireMessage::Entry*> delimited;
+        for (const WireMessage::Entry& entry : message_->entries()) {
+          if (entry.wire_type == WIRETYPE_LENGTH_DELIMITED)
+            delimited.push_back(&entry);
+        }
+        if (delimited.empty()) return false;
+        const WireMessage::Entry& entry =
+            *delimited[GetRandomIndex(random_, delimited.size())];
+        uint64_t length = entry.end - entry.payload_begin;
+        std::string encoded;
+        AppendVarint(length + 1 + GetRandomIndex(random_, length + 16),
+                     &encoded);
+        return message_->Splice(entry.value_begin,
+                                entry.payload_begin - entry.value_begin,
+                                encoded);
+      }
+      case 2: {
+        // Random tag with random wire type and no value.
+        std::string tag;
+        AppendVarint(GetRandomIndex(random_, 1 << 16), &tag);
+        return message_->Splice(GetRandomIndex(random_, size + 1), 0, tag);
+      }
+      default: {
+        if (!size) return false;
+        message_->data()[GetRandomIndex(random_, size)] ^=
+            1 << GetRandomIndex(random_, 8);
+        return true;
+      }
+    }
+  }
+
+ private:
+  bool Add(int node, const FieldDescriptor& field) {
+    const WireMessage::Node& parent = message_->nodes()[node];
+    std::string value;
+    AppendVarint(
+        (static_cast<uint64_t>(field.number()) << 3) | GetWireType(field),
+        &value);
+    AppendDefaultValue(field, &value);
+    size_t index = GetRandomIndex(random_, parent.entries.size() + 1);
+    size_t pos = index < parent.entries.size()
+                     ? message_->entries()[parent.entries[index]].begin
+                     : parent.end;
+    return message_->Replace(node, pos, 0, value);
+  }
+
+  bool Mutate(const WireMessage::Entry& entry) {
+    const FieldDescriptor& field = *entry.field;
+    uint8_t* data = message_->data();
+    if (entry.wire_type != WIRETYPE_LENGTH_DELIMITED) {
+      FlipValueBit(entry.wire_type, entry.value_begin, entry.end, data,
+                   random_);
+      return true;
+    }
+    if (field.type() != FieldDescriptor::TYPE_STRING &&
+        field.type() != FieldDescriptor::TYPE_BYTES) {
+      // Packed scalars.
+      if (entry.payload_begin == entry.end) return false;
+      FlipValueBit(GetWireType(field), entry.payload_begin, entry.end, data,
+                   random_);
+      return true;
+    }
+    std::string original = message_->Bytes(entry.payload_begin, entry.end);
+    std::string value = original;
+    MutateBytes(&value, random_);
+    if (IsUtf8Field(field)) FixUtf8String(&value, random_);
+    // UTF-8 fix may revert the change.
+    if (value == original) return false;
+    std::string encoded;
+    AppendVarint(value.size(), &encoded);
+    encoded += value;
+    return message_->Replace(entry.node, entry.value_begin,
+                             entry.end - entry.value_begin, encoded);
+  }
+
+  bool Copy(int destination) {
+    const auto& entries = message_->entries();
+    const WireMessage::Entry& entry = entries[destination];
+    std::string current = message_->Bytes(entry.value_begin, entry.end);
+    WeightedReservoirSkipSampler<int, RandomEngine> sampler(random_);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const WireMessage::Entry& source = entries[i];
+      if (!source.field || source.wire_type != entry.wire_type) continue;
+      if (!IsSameValueType(*source.field, *entry.field)) continue;
+      if (source.end - source.value_begin == current.size() &&
+          !memcmp(message_->data() + source.value_begin, current.data(),
+                  current.size())) {
+        continue;
+      }
+      sampler.Try(1, i);
+    }
+    if (sampler.IsEmpty()) return false;
+    const WireMessage::Entry& source = entries[sampler.selected()];
+    // Source may overlap with the destination.
+    return message_->Replace(
+        entry.node, entry.value_begin, entry.end - entry.value_begin,
+        message_->Bytes(source.value_begin, source.end));
+  }
+
+  WireMessage* message_;
+  RandomEngine* random_;
+};
+
+}  // namespace
+
+WireMutator::WireMutator(RandomEngine* random) : random_(random) {}
+
+bool WireMutator::Mutate(const Descriptor* descriptor, uint8_t* data,
+                         size_t* size, size_t max_size) {
+  if (*size > max_size) return false;
+  WireMessage message(data, *size, max_size);
+  if (!message.Index(descriptor)) return false;
+  WireMutation mutation(&message, random_);
+
+  bool mutated = allow_malformed_ && GetRandomBool(random_, 4) &&
+                 mutation.ApplyMalformed();
+  // Failed mutations keep data unchanged, so the index stays valid for
+  // retries.
+  for (int i = 0; !mutated && i < kMaxAttempts; ++i) {
+    Candidate candidate = mutation.Sample();
+    if (candidate.mutation == Mutation::None) return false;
+    mutated = mutation.Apply(candidate);
+  }
+  if (mutated) *size = message.size();
+  return mutated;
+}
+
+}  // namespace protobuf_mutator
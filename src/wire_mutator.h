@@ -0,0 +1,60 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_WIRE_MUTATOR_H_
+#define SRC_WIRE_MUTATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "port/protobuf.h"
+#include "src/random.h"
+
+namespace protobuf_mutator {
+
+// Mutates binary encoded protobuf messages without parsing them into
+// protobuf::Message. Input is scanned once into an index of field offsets
+// guided by the message Descriptor. Add, Delete, Mutate and Copy of a field are
+// applied directly to the byte ranges, and length prefixes of enclosing
+// messages are updated. Cost of a mutation is a memmove of the input instead of
+// a parse and a serialization.
+//
+// Results are valid binary encodings which may miss required fields, the same
+// as ParseBinaryMessage accepts.
+//
+// Usage example:
+//    protobuf_mutator::WireMutator mutator(&random);
+//    mutator.Mutate(MyMessage::descriptor(), data, &size, max_size);
+class WireMutator {
+ public:
+  explicit WireMutator(RandomEngine* random);
+
+  // Mutates |*size| bytes of |data| encoding message of |descriptor| type and
+  // updates |*size|. |data| must have room for |max_size| bytes. Returns false
+  // if the input is not a valid encoding or no mutation fits into |max_size|.
+  bool Mutate(const protobuf::Descriptor* descriptor, uint8_t* data,
+              size_t* size, size_t max_size);
+
+  // If enabled, some mutations produce malformed encodings, e.g. truncated
+  // values or wrong length prefixes, to fuzz the protobuf parser itself.
+  void set_allow_malformed(bool allow) { allow_malformed_ = allow; }
+
+ private:
+  RandomEngine* random_;
+  bool allow_malformed_ = false;
+};
+
+}  // namespace protobuf_mutator
+
+#endif  // SRC_WIRE_MUTATOR_H_
@@ -0,0 +1,155 @@
+// Copyright 2018 Baidu X-Lab. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/wire_mutator.h"
+
+#include <set>
+#include <string>
+
+#include "port/gtest.h"
+#include "src/binary_format.h"
+#include "src/mutator.h"
+#include "src/mutator_test_proto2.pb.h"
+#include "src/mutator_test_proto3.pb.h"
+
+namespace protobuf_mutator {
+
+using protobuf::util::MessageDifferencer;
+
+const size_t kMaxSize = 1 << 16;
+
+template <typename T>
+class WireMutatorTypedTest : public ::testing::Test {
+ public:
+  using Message = T;
+
+  // Returns binary encoding of a random message.
+  std::string CreateInput(Mutator* mutator) {
+    Message message;
+    for (int i = 0; i < 20; ++i) mutator->Mutate(&message, 1000);
+    return SaveMessageAsBinary(message);
+  }
+};
+
+using WireMutatorTypedTestTypes = testing::Types<Msg, Msg3>;
+TYPED_TEST_CASE(WireMutatorTypedTest, WireMutatorTypedTestTypes);
+
+TYPED_TEST(WireMutatorTypedTest, ValidMutations) {
+  RandomEngine random(5);
+  Mutator mutator(&random);
+  WireMutator wire_mutator(&random);
+  const protobuf::Descriptor* descriptor =
+      TestFixture::Message::descriptor();
+  size_t unchanged = 0;
+  for (int i = 0; i < 1000; ++i) {
+    std::string input = this->CreateInput(&mutator);
+    std::string data = input;
+    for (int j = 0; j < 10; ++j) {
+      std::string previous = data;
+      size_t size = data.size();
+      data.resize(kMaxSize);
+      ASSERT_TRUE(wire_mutator.Mutate(
+          descriptor, reinterpret_cast<uint8_t*>(&data[0]), &size, kMaxSize));
+      data.resize(size);
+      if (data == previous) ++unchanged;
+
+      // Result must parse and match the parsed and serialized result.
+      typename TestFixture::Message message;
+      ASSERT_TRUE(ParseBinaryMessage(data, &message));
+      typename TestFixture::Message reparsed;
+      ASSERT_TRUE(ParseBinaryMessage(SaveMessageAsBinary(message), &reparsed));
+      EXPECT_TRUE(MessageDifferencer::Equals(message, reparsed));
+    }
+  }
+  EXPECT_EQ(0u, unchanged);
+}
+
+TYPED_TEST(WireMutatorTypedTest, MalformedMutations) {
+  RandomEngine random(5);
+  Mutator mutator(&random);
+  WireMutator wire_mutator(&random);
+  wire_mutator.set_allow_malformed(true);
+  const protobuf::Descriptor* descriptor =
+      TestFixture::Message::descriptor();
+  size_t malformed = 0;
+  for (int i = 0; i < 1000; ++i) {
+    std::string data = this->CreateInput(&mutator);
+    size_t size = data.size();
+    data.resize(kMaxSize);
+    if (!wire_mutator.Mutate(descriptor, reinterpret_cast<uint8_t*>(&data[0]),
+                             &size, kMaxSize)) {
+      continue;
+    }
+    data.resize(size);
+    typename TestFixture::Message message;
+    if (!ParseBinaryMessage(data, &message)) ++malformed;
+  }
+  EXPECT_GT(malformed, 50u);
+  EXPECT_LT(malformed, 500u);
+}
+
+TEST(WireMutatorTest, LengthPrefixes) {
+  RandomEngine random(1);
+  WireMutator wire_mutator(&random);
+  Msg message;
+  Msg* nested = &message;
+  for (int i = 0; i < 5; ++i) nested = nested->mutable_optional_msg();
+  // 127 bytes fit into one byte length prefix, so mutations often change
+  // size of prefixes.
+  nested->set_optional_string(std::string(127, 'a'));
+
+  std::set<std::string> results;
+  for (int i = 0; i < 1000; ++i) {
+    std::string data = SaveMessageAsBinary(message);
+    size_t size = data.size();
+    data.resize(kMaxSize);
+    ASSERT_TRUE(wire_mutator.Mutate(Msg::descriptor(),
+                                    reinterpret_cast<uint8_t*>(&data[0]),
+                                    &size, kMaxSize));
+    data.resize(size);
+    Msg parsed;
+    ASSERT_TRUE(ParseBinaryMessage(data, &parsed));
+    results.insert(data);
+  }
+  EXPECT_GT(results.size(), 100u);
+}
+
+TEST(WireMutatorTest, MaxSize) {
+  RandomEngine random(1);
+  WireMutator wire_mutator(&random);
+  std::string data = SaveMessageAsBinary(Msg());
+  for (int i = 0; i < 1000; ++i) {
+    size_t size = data.size();
+    data.resize(100);
+    if (wire_mutator.Mutate(Msg::descriptor(),
+                            reinterpret_cast<uint8_t*>(&data[0]), &size,
+                            100)) {
+      EXPECT_LE(size, 100u);
+    }
+    data.resize(size);
+  }
+}
+
+TEST(WireMutatorTest, InvalidInput) {
+  RandomEngine random(1);
+  WireMutator wire_mutator(&random);
+  // Truncated length-delimited field.
+  uint8_t data[16] = {0x0A, 0x05, 'a'};
+  size_t size = 3;
+  EXPECT_FALSE(
+      wire_mutator.Mutate(Msg::descriptor(), data, &size, sizeof(data)));
+  EXPECT_EQ(3u, size);
+}
+
+}  // namespace protobuf_mutator